@@ -0,0 +1,54 @@
+#include "iobuffer.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+namespace iocoro
+{
+
+BufferPool::BufferPool(std::size_t bufferSize)
+: d_bufferSize(std::max(bufferSize, sizeof(FreeBuffer)))
+{
+    // keep buffers aligned for the free list links
+    d_bufferSize = (d_bufferSize + alignof(FreeBuffer) - 1) & ~(alignof(FreeBuffer) - 1);
+}
+
+void BufferPool::addSlab()
+{
+    d_slabs.emplace_back(new char[d_bufferSize * BUFFERS_PER_SLAB]);
+    char* base = d_slabs.back().get();
+
+    // push in reverse, so buffers are handed out in address order
+    for (std::size_t i = BUFFERS_PER_SLAB; i-- > 0;) {
+        FreeBuffer* node = reinterpret_cast<FreeBuffer*>(base + i * d_bufferSize);
+        node->next = d_freeList;
+        d_freeList = node;
+        ++d_free;
+    }
+}
+
+char* BufferPool::allocate()
+{
+    if (d_freeList == nullptr)
+        addSlab();
+
+    FreeBuffer* node = d_freeList;
+    d_freeList = node->next;
+    --d_free;
+    ++d_inUse;
+    return reinterpret_cast<char*>(node);
+}
+
+void BufferPool::deallocate(char* buf)
+{
+    assert(buf != nullptr);
+
+    FreeBuffer* node = reinterpret_cast<FreeBuffer*>(buf);
+    node->next = d_freeList;
+    d_freeList = node;
+    ++d_free;
+    --d_inUse;
+}
+
+}
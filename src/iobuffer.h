@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace iocoro
+{
+
+// Fixed size I/O buffers of one Dispatcher. Buffers are carved from
+// slabs and recycled through a free list, so connections picking up
+// and dropping buffers do not go to malloc. Not thread-safe.
+class BufferPool
+{
+    struct FreeBuffer
+    {
+        FreeBuffer* next;
+    };
+
+    std::size_t d_bufferSize;
+    std::size_t d_inUse{0};
+    std::size_t d_free{0};
+    FreeBuffer* d_freeList{nullptr};
+    std::vector<std::unique_ptr<char[]>> d_slabs;
+
+    void addSlab();
+
+public:
+    static const std::size_t DEFAULT_BUFFER_SIZE = 16 * 1024;
+    static const std::size_t BUFFERS_PER_SLAB = 64;
+
+    explicit BufferPool(std::size_t bufferSize = DEFAULT_BUFFER_SIZE);
+
+    std::size_t bufferSize() const { return d_bufferSize; }
+    std::size_t inUse() const { return d_inUse; }
+    std::size_t free() const { return d_free; }
+
+    char* allocate();
+    void deallocate(char* buf);
+
+    // noncopyable
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator = (const BufferPool&) = delete;
+};
+
+}
@@ -1,5 +1,13 @@
 #include "iocommon.h"
 #include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <stdexcept>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 namespace iocoro
 {
@@ -22,6 +30,13 @@ void FileHandle::close()
     }
 }
 
+int FileHandle::release()
+{
+    int fd = d_fd;
+    d_fd = -1;
+    return fd;
+}
+
 FileHandle& FileHandle::operator = (FileHandle&& f)
 {
     close();
@@ -31,5 +46,55 @@ FileHandle& FileHandle::operator = (FileHandle&& f)
     return *this;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// class WakeupFd
+//////////////////////////////////////////////////////////////////////////
+WakeupFd::WakeupFd()
+{
+#ifdef __linux__
+    d_read = FileHandle(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (d_read == -1)
+        throw std::runtime_error("Failed to create eventfd");
+#else
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw std::runtime_error("Failed to create pipe");
+
+    d_read = FileHandle(fds[0]);
+    d_write = FileHandle(fds[1]);
+
+    for (int fd : fds) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+}
+
+void WakeupFd::signal()
+{
+#ifdef __linux__
+    uint64_t one = 1;
+    ssize_t r = ::write(d_read, &one, sizeof(one));
+#else
+    char one = 1;
+    ssize_t r = ::write(d_write, &one, sizeof(one));
+#endif
+    // EAGAIN means counter/pipe is full, reader is going to wake anyway
+    (void)r;
+}
+
+bool WakeupFd::drain()
+{
+#ifdef __linux__
+    uint64_t value = 0;
+    return ::read(d_read, &value, sizeof(value)) > 0;
+#else
+    char buf[64];
+    bool signalled = false;
+    while (::read(d_read, buf, sizeof(buf)) > 0)
+        signalled = true;
+    return signalled;
+#endif
 }
 
+}
@@ -14,6 +14,8 @@ public:
     operator int () const { return d_fd; }
     int handle() const { return d_fd; }
     void close();
+    // gives up ownership without closing
+    int release();
 
     FileHandle& operator = (FileHandle&& f);
 
@@ -22,5 +24,21 @@ public:
     FileHandle& operator = (const FileHandle&) = delete;
 };
 
+// Non-blocking descriptor that becomes readable when signalled,
+// signal() may be called from any thread.
+// Uses eventfd on Linux and a pipe elsewhere.
+class WakeupFd
+{
+    FileHandle d_read;
+    FileHandle d_write;
+public:
+    WakeupFd();
+
+    int handle() const { return d_read; }
+    void signal();
+    // consumes pending signals, returns false if there were none
+    bool drain();
+};
+
 }
 
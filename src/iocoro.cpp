@@ -1,5 +1,10 @@
 #include "iocoro.h"
+#include "iouring.h"
 #include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include <algorithm>
 
 #include <thread>
 #include <iostream>
@@ -15,13 +20,13 @@ thread_local Context* tls_currentContext = nullptr;
 //////////////////////////////////////////////////////////////////////////
 
 ContextPoll::ContextPoll(int f)
-: FilePoll(f)
+: FilePoll(-1)
 {
     add(f);
 }
 
 ContextPoll::ContextPoll(ContextPoll&& ctx)
-: FilePoll(ctx.fd)
+: FilePoll(-1)
 {
     *this = std::move(ctx);
 }
@@ -35,61 +40,137 @@ void ContextPoll::add(int f)
 {
     remove();
     fd = f;
-
-    if (fd != -1)
-        getCurrentPoller().add(this);
 }
 
 void ContextPoll::remove()
 {
-    if (fd != -1) {
+    if (d_registered) {
         getCurrentPoller().remove(this);
-        fd = -1;
+        ++d_stats.pollerCalls;
+        d_registered = false;
+    }
+    fd = -1;
+}
+
+void ContextPoll::release()
+{
+    if (d_registered) {
+        getCurrentPoller().forget(this);
+        d_registered = false;
+    }
+    fd = -1;
+}
+
+void ContextPoll::arm(Poller& poller)
+{
+    if (!d_registered && fd != -1) {
+        poller.add(this);
+        ++d_stats.pollerCalls;
+        d_registered = true;
     }
 }
 
 void ContextPoll::handleEvents(uint32_t events)
 {
     if (events & EventType::Write) {
-        if (writeContext != nullptr) {
-            writeContext->enable();
-        }
+        d_write.ready = true;
+        wakeFirst(d_write);
     }
 
     if (events & EventType::Read) {
-        if (readContext != nullptr) {
-            readContext->enable();
-        }
+        d_read.ready = true;
+        wakeFirst(d_read);
     }
+
+    if (events & EventType::Error) {
+        d_error.ready = true;
+        wakeFirst(d_error);
+    }
+}
+
+void ContextPoll::wakeFirst(Direction& dir)
+{
+    if (dir.waiters.empty())
+        return;
+
+    WaitNode& w = dir.waiters.front();
+    dir.waiters.pop_front();
+    w.notified = true;
+    w.ctx->enable();
 }
 
-void ContextPoll::waitRead()
+int ContextPoll::wait(Direction& dir, Clock::time_point deadline)
 {
-    if (readContext != nullptr)
-        throw std::runtime_error("Another context is reading");
+    if (Context::clearInterrupt())
+        return ECANCELED;
+
+    // edge-triggered registration reports readiness that is already
+    // there, so registering after EAGAIN does not miss events
+    arm(getCurrentPoller());
+    ++d_stats.waits;
 
-    readContext = Context::self();
-    readContext->disable();
-    Context::yield();
-    readContext = nullptr;
+    // the caller has just seen EAGAIN
+    dir.ready = false;
+
+    WaitNode w(Context::self());
+    dir.waiters.push_back(w);
+
+    uint32_t flags;
+    for (;;) {
+        w.ctx->schedule(deadline);
+        flags = Context::yield();
+
+        // a waiter that ran before took the readiness,
+        // keep the place in the queue until the next edge
+        if (w.notified && !dir.ready && !(flags & (Flags::Interrupt | Flags::Schedule))) {
+            w.notified = false;
+            dir.waiters.push_front(w);
+            continue;
+        }
+        break;
+    }
+
+    // with edge-triggered polling no other edge comes while the fd
+    // stays ready, so the next waiter has to try too
+    if (w.notified && dir.ready)
+        wakeFirst(dir);
+
+    if ((flags & Flags::Interrupt) && Context::clearInterrupt())
+        return ECANCELED;
+    if (flags & Flags::Schedule)
+        return ETIMEDOUT;
+    return 0;
+}
+
+int ContextPoll::waitRead(Clock::time_point deadline)
+{
+    return wait(d_read, deadline);
 }
 
-void ContextPoll::waitWrite()
+int ContextPoll::waitWrite(Clock::time_point deadline)
 {
-    if (writeContext != nullptr)
-        throw std::runtime_error("Another context is writing");
+    return wait(d_write, deadline);
+}
 
-    writeContext = Context::self();
-    writeContext->disable();
-    Context::yield();
-    writeContext = nullptr;
+int ContextPoll::waitError(Clock::time_point deadline)
+{
+    return wait(d_error, deadline);
 }
 
 ContextPoll& ContextPoll::operator = (ContextPoll&& ctx)
 {
-    int newFd = ctx.fd;
-    ctx.remove();
-    add(newFd);
+    remove();
+    fd = ctx.fd;
+    d_registered = ctx.d_registered;
+    d_stats = ctx.d_stats;
+    ctx.fd = -1;
+    ctx.d_registered = false;
+
+    // one syscall to retarget instead of removing and adding again
+    if (d_registered) {
+        getCurrentPoller().modify(this);
+        ++d_stats.pollerCalls;
+    }
 
     return *this;
 }
@@ -106,31 +187,38 @@ void Context::cc()
     d_coro = d_coro.resume();
 }
 
-void Context::init(std::function<void()>&& entry) 
+void Context::init() 
 { 
-    d_entry = std::move(entry); 
     d_finished = false;
     d_deadline = Clock::time_point::min();
+    d_wakeFlags = Flags::None;
+    d_wokenAt = TimePoint::min();
+    d_latencyTag = nullptr;
 }
 
-bool Context::resume(uint32_t wakeFlags)
+Context* Context::resume(uint32_t wakeFlags)
 {
     if (d_finished) {
-        return false;
+        return this;
     }
 
-    d_wakeFlags = wakeFlags;
+    d_wakeFlags |= wakeFlags;
     tls_currentContext = this;
 
+    ctx::continuation c;
     if (d_coro) {
-        cc();
+        c = d_coro.resume();
     } else {
-        d_coro = ctx::callcc([this](ctx::continuation&& c) {
+        c = ctx::callcc(std::allocator_arg, 
+                StackAllocator::Ref(d_dispatcher.getStackAllocator()),
+                [this](ctx::continuation&& c) {
             d_coro = std::move(c);
 
             // allow context to be reused (set different entry function)
             for (;;) {
                 d_entry();
+                // release captured state right away, not on reuse
+                d_entry.reset();
                 d_finished = true;
                 d_coro = d_coro.resume();
             }
@@ -139,8 +227,12 @@ bool Context::resume(uint32_t wakeFlags)
         });
     }    
 
+    // after switchTo() another context may be the one coming back
+    Context* back = tls_currentContext;
+    back->d_coro = std::move(c);
+
     tls_currentContext = nullptr;
-    return !d_finished;
+    return back;
 }
 
 void Context::disable()
@@ -160,6 +252,22 @@ void Context::schedule(Clock::time_point deadline)
     d_dispatcher.schedule(this, deadline);
 }
 
+void Context::interrupt()
+{
+    d_wakeFlags |= Flags::Interrupt;
+    enable();
+}
+
+void Context::setLatencyTag(const std::string& tag)
+{
+    d_latencyTag = &d_dispatcher.taggedLatency(tag);
+}
+
+void Context::wakeFromAnyThread()
+{
+    d_dispatcher.wakeRemote(this);
+}
+
 Context* Context::self()
 {
     return tls_currentContext;
@@ -167,10 +275,47 @@ Context* Context::self()
 
 uint32_t Context::yield()
 {
+    // interrupt stays pending until an interruptible wait takes it
+    self()->d_wakeFlags &= Flags::Interrupt;
     self()->cc();
     return self()->d_wakeFlags;
 }
 
+bool Context::clearInterrupt()
+{
+    Context* current = self();
+    bool interrupted = (current->d_wakeFlags & Flags::Interrupt) != 0;
+    current->d_wakeFlags &= ~Flags::Interrupt;
+    return interrupted;
+}
+
+void Context::switchTo(Context* next)
+{
+    Context* current = self();
+    next->enable();
+
+    if (next == current || !next->d_coro || next->d_finished) {
+        yield();
+        return;
+    }
+
+    assert(&next->d_dispatcher == &current->d_dispatcher);
+    tls_currentContext = next;
+    current->d_dispatcher.countSwitch(next);
+
+    // next takes over the way back to the dispatcher,
+    // current one is suspended in its place
+    ctx::continuation dispatcher = std::move(current->d_coro);
+    ctx::continuation c = next->d_coro.resume_with(
+            [current, &dispatcher](ctx::continuation&& from) {
+        current->d_coro = std::move(from);
+        return std::move(dispatcher);
+    });
+
+    // resumed by the dispatcher
+    current->d_coro = std::move(c);
+}
+
 void Context::sleep_for(Clock::duration d)
 {
     sleep_until(Clock::now() + d);
@@ -178,39 +323,85 @@ void Context::sleep_for(Clock::duration d)
 
 void Context::sleep_until(Clock::time_point t)
 {
-    self()->schedule(t);
-    self()->cc();
+    // woken early, e.g. by interrupt(), which stays pending
+    do {
+        self()->schedule(t);
+        yield();
+    } while (Clock::now() < t);
 }
 
 //////////////////////////////////////////////////////////////////////////
-// class Event
+// class WaitQueue
 //////////////////////////////////////////////////////////////////////////
-void Event::notify(bool one)
+bool WaitQueue::wait(Clock::time_point deadline)
 {
-    d_signalled = true;
-    while (d_begin != nullptr) {
-        auto ctx = d_begin->ctx;
-        d_begin = d_begin->next;
-        ctx->enable();
-        if (one) {
-            break;
+    if (Context::clearInterrupt()) {
+        errno = ECANCELED;
+        return false;
+    }
+
+    WaitNode w(Context::self());
+    d_waiters.push_back(w);
+
+    // on timeout or interrupt w unlinks itself
+    for (;;) {
+        w.ctx->schedule(deadline);
+        uint32_t flags = Context::yield();
+
+        // dequeued wins, an interrupt stays pending then
+        if (w.notified)
+            return true;
+
+        if ((flags & Flags::Interrupt) && Context::clearInterrupt()) {
+            errno = ECANCELED;
+            return false;
+        }
+
+        if (deadline != Clock::time_point::max() && Clock::now() >= deadline) {
+            errno = ETIMEDOUT;
+            return false;
         }
     }
+}
 
-    // let scheduler call enabled contexts
-    Context::yield();
-    d_signalled = false;
+Context* WaitQueue::dequeue()
+{
+    if (d_waiters.empty())
+        return nullptr;
+
+    WaitNode& w = d_waiters.front();
+    d_waiters.pop_front();
+    w.notified = true;
+    return w.ctx;
+}
+
+void WaitQueue::notifyAll()
+{
+    while (Context* ctx = dequeue()) {
+        ctx->enable();
+    }
 }
 
-void Event::addWaiter(WaiterNode& node)
+//////////////////////////////////////////////////////////////////////////
+// class Event
+//////////////////////////////////////////////////////////////////////////
+void Event::notify(bool one)
 {
-    if (d_begin == nullptr) {
-        d_begin = &node;
-        d_end = &node;
+    d_signalled = true;
+
+    Context* first = d_waiters.dequeue();
+    if (!one) {
+        d_waiters.notifyAll();
+    }
+
+    if (first != nullptr) {
+        // run the first waiter right away,
+        // others are called by the scheduler
+        Context::switchTo(first);
     } else {
-        d_end->next = &node;
-        d_end = &node;
+        Context::yield();
     }
+    d_signalled = false;
 }
 
 void Event::notify_one()
@@ -223,17 +414,12 @@ void Event::notify_all()
     notify(false);
 }
 
-void Event::wait()
+bool Event::wait()
 {
     if (d_signalled)
-        return;
+        return true;
 
-    auto ctx = Context::self();
-    WaiterNode node{ctx, 0};
-    addWaiter(node);
-    // Start waiting
-    ctx->disable();
-    Context::yield();
+    return d_waiters.wait();
 }
 
 bool Event::wait_for(Clock::duration d)
@@ -241,41 +427,428 @@ bool Event::wait_for(Clock::duration d)
     if (d_signalled)
         return true;
 
-    auto ctx = Context::self();
-    WaiterNode node{ctx, 0};
-    addWaiter(node);
-    // Start waiting
-    ctx->schedule(Clock::now() + d);
-    Context::yield();
+    return d_waiters.wait(Clock::now() + d);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// class ChannelBase
+//////////////////////////////////////////////////////////////////////////
+ChannelBase::~ChannelBase()
+{
+    assert(d_senders.empty() && d_receivers.empty());
+}
+
+ChannelBase::Waiter* ChannelBase::popWaiter(WaitList& list)
+{
+    while (!list.empty()) {
+        Waiter& w = list.front();
+        list.pop_front();
+
+        // another case of the same select has already completed
+        if (w.selector->fired == -1)
+            return &w;
+    }
+
+    return nullptr;
+}
+
+void ChannelBase::fire(Waiter& w, bool ok)
+{
+    w.ok = ok;
+    w.selector->fired = w.index;
+    w.selector->ctx->enable();
+}
+
+void ChannelBase::close()
+{
+    d_closed = true;
+
+    while (Waiter* w = popWaiter(d_senders)) {
+        fire(*w, false);
+    }
+
+    // there are no buffered values if receivers wait
+    while (Waiter* w = popWaiter(d_receivers)) {
+        fire(*w, false);
+    }
+}
+
+bool ChannelBase::tryComplete(ChannelCase& c)
+{
+    bool ok = true;
+
+    if (c.send) {
+        if (d_closed) {
+            ok = false;
+        } else if (!trySend(c.value)) {
+            return false;
+        }
+    } else if (!tryRecv(c.value)) {
+        if (!d_closed)
+            return false;
+        ok = false;
+    }
+
+    if (c.ok)
+        *c.ok = ok;
+    return true;
+}
+
+int ChannelBase::select(ChannelCase* cases, Waiter* waiters, std::size_t count,
+        Clock::time_point deadline)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        if (cases[i].channel->tryComplete(cases[i]))
+            return i;
+    }
+
+    if (deadline != Clock::time_point::max() && Clock::now() >= deadline)
+        return -1;
+
+    Selector selector{Context::self(), -1};
+    for (std::size_t i = 0; i < count; ++i) {
+        Waiter& w = waiters[i];
+        w.selector = &selector;
+        w.index = i;
+        w.value = cases[i].value;
+
+        ChannelBase* ch = cases[i].channel;
+        (cases[i].send ? ch->d_senders : ch->d_receivers).push_back(w);
+    }
+
+    do {
+        selector.ctx->schedule(deadline);
+        Context::yield();
+    } while (selector.fired == -1 && 
+            (deadline == Clock::time_point::max() || Clock::now() < deadline));
+
+    for (std::size_t i = 0; i < count; ++i) {
+        if (waiters[i].is_linked()) {
+            ChannelBase* ch = cases[i].channel;
+            WaitList& list = cases[i].send ? ch->d_senders : ch->d_receivers;
+            list.erase(list.iterator_to(waiters[i]));
+        }
+    }
+
+    if (selector.fired != -1 && cases[selector.fired].ok) {
+        *cases[selector.fired].ok = waiters[selector.fired].ok;
+    }
+
+    return selector.fired;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// class TimerHeap
+//////////////////////////////////////////////////////////////////////////
+namespace {
+
+const std::size_t TIMER_HEAP_ARITY = 4;
+
+}
+
+void TimerHeap::place(std::size_t i, Context* ctx)
+{
+    d_heap[i] = ctx;
+    ctx->d_timerIndex = i;
+}
+
+void TimerHeap::siftUp(std::size_t i)
+{
+    Context* ctx = d_heap[i];
+
+    while (i > 0) {
+        std::size_t parent = (i - 1) / TIMER_HEAP_ARITY;
+        if (d_heap[parent]->d_deadline <= ctx->d_deadline)
+            break;
+
+        place(i, d_heap[parent]);
+        i = parent;
+    }
+
+    place(i, ctx);
+}
+
+void TimerHeap::siftDown(std::size_t i)
+{
+    Context* ctx = d_heap[i];
+    const std::size_t size = d_heap.size();
+
+    for (;;) {
+        std::size_t first = i * TIMER_HEAP_ARITY + 1;
+        if (first >= size)
+            break;
+
+        // find the earliest of up to 4 children
+        std::size_t last = std::min(first + TIMER_HEAP_ARITY, size);
+        std::size_t best = first;
+        for (std::size_t c = first + 1; c < last; ++c) {
+            if (d_heap[c]->d_deadline < d_heap[best]->d_deadline)
+                best = c;
+        }
+
+        if (ctx->d_deadline <= d_heap[best]->d_deadline)
+            break;
+
+        place(i, d_heap[best]);
+        i = best;
+    }
+
+    place(i, ctx);
+}
+
+void TimerHeap::push(Context* ctx)
+{
+    d_heap.push_back(ctx);
+    siftUp(d_heap.size() - 1);
+}
+
+void TimerHeap::remove(Context* ctx)
+{
+    std::size_t i = ctx->d_timerIndex;
+    assert(i < d_heap.size() && d_heap[i] == ctx);
+
+    Context* last = d_heap.back();
+    d_heap.pop_back();
+
+    if (last == ctx)
+        return;
+
+    place(i, last);
+    update(last);
+}
+
+void TimerHeap::update(Context* ctx)
+{
+    std::size_t i = ctx->d_timerIndex;
+
+    if (i > 0 && ctx->d_deadline < d_heap[(i - 1) / TIMER_HEAP_ARITY]->d_deadline) {
+        siftUp(i);
+    } else {
+        siftDown(i);
+    }
+}
+
+namespace {
+
+// enough for the file reads of all contexts in one loop iteration
+const unsigned FILE_RING_ENTRIES = 64;
 
-    return d_signalled;
 }
 
 //////////////////////////////////////////////////////////////////////////
 // class Dispatcher 
 //////////////////////////////////////////////////////////////////////////
-Dispatcher::Dispatcher()
+Dispatcher::Dispatcher(const StackPolicy& stackPolicy)
+: d_stacks(stackPolicy)
 {
+    d_poller.add(&d_remotePoll);
+
+    if (getenv("IOCORO_IO_URING") != nullptr) {
+        useIoUring();
+    }
 }
 
 Dispatcher::~Dispatcher()
 {
-    fprintf(stderr, "Dispatcher: %zu contexts in cache\n", d_unused.size());
+    d_poller.remove(&d_remotePoll);
+
+    if (d_ring) {
+        d_poller.remove(d_ring.get());
+    }
+
+    if (d_fileRing) {
+        d_poller.remove(d_fileRing.get());
+    }
+
+    PostedTask* task = d_posted.exchange(nullptr);
+    while (task != nullptr) {
+        PostedTask* next = task->next;
+        delete task;
+        task = next;
+    }
+}
+
+bool Dispatcher::useIoUring(unsigned entries, bool registerFiles)
+{
+    if (d_ring)
+        return true;
+
+    d_ring = IoUring::create(entries, registerFiles);
+    if (!d_ring)
+        return false;
+
+    // completions wake the poller through the ring fd
+    d_poller.add(d_ring.get());
+    return true;
+}
+
+IoUring* Dispatcher::getFileRing()
+{
+    if (d_ring)
+        return d_ring.get();
+
+    // probed once, the thread pool of AsyncFile is used if this fails
+    if (!d_fileRingProbed) {
+        d_fileRingProbed = true;
+        d_fileRing = IoUring::create(FILE_RING_ENTRIES, false);
+        if (d_fileRing)
+            d_poller.add(d_fileRing.get());
+    }
+
+    return d_fileRing.get();
+}
+
+void Dispatcher::RemotePoll::handleEvents(uint32_t /*events*/)
+{
+    d_dispatcher.handleRemote();
+}
+
+void Dispatcher::post(std::function<void()>&& f)
+{
+    PostedTask* task = new PostedTask{nullptr, std::move(f)};
+    task->next = d_posted.load(std::memory_order_relaxed);
+    while (!d_posted.compare_exchange_weak(task->next, task, 
+                std::memory_order_release, std::memory_order_relaxed)) {
+    }
+
+    signalRemote();
+}
+
+void Dispatcher::wakeRemote(Context* ctx)
+{
+    // context already queued, it will be woken anyway
+    if (ctx->d_remoteWake.exchange(true))
+        return;
+
+    ctx->d_nextRemote = d_remoteWoken.load(std::memory_order_relaxed);
+    while (!d_remoteWoken.compare_exchange_weak(ctx->d_nextRemote, ctx, 
+                std::memory_order_release, std::memory_order_relaxed)) {
+    }
+
+    signalRemote();
+}
+
+void Dispatcher::completeRemote(RemoteCompletion& c)
+{
+    c.next = d_remoteCompleted.load(std::memory_order_relaxed);
+    while (!d_remoteCompleted.compare_exchange_weak(c.next, &c, 
+                std::memory_order_release, std::memory_order_relaxed)) {
+    }
+
+    signalRemote();
+}
+
+void Dispatcher::signalRemote()
+{
+    // only the first producer after the last drain pays for the syscall
+    if (!d_remotePending.exchange(true))
+        d_remoteFd.signal();
+}
+
+void Dispatcher::handleRemote()
+{
+    d_remoteFd.drain();
+    // reset before taking the queues, later producers will signal again
+    d_remotePending.store(false);
+
+    Context* ctx = d_remoteWoken.exchange(nullptr, std::memory_order_acquire);
+    while (ctx != nullptr) {
+        Context* next = ctx->d_nextRemote;
+        ctx->d_remoteWake.store(false);
+        ctx->enable();
+        ctx = next;
+    }
+
+    RemoteCompletion* c = d_remoteCompleted.exchange(nullptr, std::memory_order_acquire);
+    while (c != nullptr) {
+        // c may be gone once its context runs
+        RemoteCompletion* next = c->next;
+        c->done = true;
+        c->ctx->enable();
+        c = next;
+    }
+
+    PostedTask* task = d_posted.exchange(nullptr, std::memory_order_acquire);
+
+    // stack is LIFO, restore posting order
+    PostedTask* fifo = nullptr;
+    while (task != nullptr) {
+        PostedTask* next = task->next;
+        task->next = fifo;
+        fifo = task;
+        task = next;
+    }
+
+    while (fifo != nullptr) {
+        PostedTask* next = fifo->next;
+        spawn(std::move(fifo->fn));
+        delete fifo;
+        fifo = next;
+    }
+}
+
+namespace {
+
+bool isSleeping(const Clock::time_point& deadline)
+{
+    return deadline != Clock::time_point::min() 
+        && deadline != Clock::time_point::max();
+}
+
+// There is a single writer, so a plain load and store is enough,
+// it avoids a locked instruction per update.
+template <class T>
+void bump(std::atomic<T>& counter, T n = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void set(std::atomic<std::size_t>& value, std::size_t n)
+{
+    value.store(n, std::memory_order_relaxed);
+}
+
+std::size_t loopBucket(int64_t ns)
+{
+    uint64_t us = ns > 0 ? ns / 1000 : 0;
+    std::size_t i = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    return i < DispatcherStats::LOOP_BUCKETS ? i : DispatcherStats::LOOP_BUCKETS - 1;
+}
+
 }
 
 void Dispatcher::schedule(Context* ctx, const Clock::time_point& deadline)
 {
-    auto& srcList = getListByDeadline(ctx->d_deadline);
-    auto& dstList = getListByDeadline(deadline);
+    auto prevDeadline = ctx->d_deadline;
 
     // update Context's value
     ctx->d_deadline = deadline; 
 
-    // update closest deadline if needed 
-    if (deadline < d_deadline) {
-        d_deadline = deadline;
+    if (d_trackLatency && deadline == Clock::time_point::min()
+            && prevDeadline != Clock::time_point::min()) {
+        ctx->d_wokenAt = Clock::now();
     }
 
+    if (isSleeping(prevDeadline)) {
+        if (isSleeping(deadline)) {
+            d_sleeping.update(ctx);
+            return;
+        }
+
+        d_sleeping.remove(ctx);
+        getListByDeadline(deadline).push_back(*ctx);
+        return;
+    }
+
+    auto& srcList = getListByDeadline(prevDeadline);
+
+    if (isSleeping(deadline)) {
+        srcList.erase(srcList.iterator_to(*ctx));
+        d_sleeping.push(ctx);
+        return;
+    }
+
+    auto& dstList = getListByDeadline(deadline);
     if (&srcList == &dstList)
         return;
 
@@ -283,30 +856,33 @@ void Dispatcher::schedule(Context* ctx, const Clock::time_point& deadline)
     dstList.splice(dstList.end(), srcList, srcList.iterator_to(*ctx));
 }
 
-boost::intrusive::list<Context>& 
-Dispatcher::getListByDeadline(const Clock::time_point& deadline)
+ContextList& Dispatcher::getListByDeadline(const Clock::time_point& deadline)
 {
     if (deadline == Clock::time_point::min())
         return d_ready;
 
-    if (deadline == Clock::time_point::max())
-        return d_disabled;
-
-    return d_sleeping;
+    assert(deadline == Clock::time_point::max());
+    return d_disabled;
 }
 
-void Dispatcher::spawn(std::function<void()>&& f)
+Context* Dispatcher::acquireContext()
 {
     Context* ctx = nullptr;
 
     if (d_unused.empty()) {
         ctx = d_pool.construct(*this);
     } else {
-        ctx = &d_unused.front();
+        ctx = static_cast<Context*>(&d_unused.front());
         d_unused.pop_front();
     } 
 
-    ctx->init(std::move(f));
+    bump<uint64_t>(d_metrics.spawns);
+    ctx->init();
+    return ctx;
+}
+
+void Dispatcher::start(Context* ctx)
+{
     d_ready.push_back(*ctx);
 
     if (Context::self()) {
@@ -316,7 +892,7 @@ void Dispatcher::spawn(std::function<void()>&& f)
     }
 }
 
-static int msToDeadline(const Clock::time_point& deadline)
+static int64_t nsToDeadline(const Clock::time_point& deadline)
 {
     if (deadline == Clock::time_point::min())
         return 0;
@@ -324,58 +900,177 @@ static int msToDeadline(const Clock::time_point& deadline)
     if (deadline == Clock::time_point::max())
         return -1;
 
-    const int64_t NS_IN_MS = 1000000;
-    // use nano precision to get correct rounding up
     auto dur = DurationNano(deadline - Clock::now()).count(); 
     if (dur <= 0) {
         return 0;
     }
 
-    return (dur + NS_IN_MS - 1) / NS_IN_MS;
+    return dur;
 }
 
 void Dispatcher::dispatch()
 {
+    TimePoint pollStart = TimePoint::min();
+
     for (;;) {
         d_now = Clock::now();
+        if (pollStart != TimePoint::min()) {
+            bump<uint64_t>(d_metrics.blockedNs, DurationNano(d_now - pollStart).count());
+        }
 
-        if (d_now >= d_deadline) {
-            // we reached at least one deadline
-            // move contexts to ready and update closest deadline time
-            d_deadline = TimePoint::max();
-
-            for (auto it = d_sleeping.begin(); it != d_sleeping.end();) {
-                // deadline passed, move to ready 
-                auto nextIt = std::next(it);
-                if (d_now >= it->d_deadline) {
-                    // advance to next element and move context to ready list
-                    auto& ctx = *it;
-                    schedule(&ctx, TimePoint::min());
-                } else if (it->d_deadline < d_deadline) {
-                    d_deadline = it->d_deadline;
-                }
-                it = nextIt;
-            }
+        // move contexts with passed deadlines to ready list
+        while (!d_sleeping.empty() && d_now >= d_sleeping.top()->d_deadline) {
+            d_sleeping.top()->d_wakeFlags |= Flags::Schedule;
+            schedule(d_sleeping.top(), TimePoint::min());
         }
 
         for (auto it = d_ready.begin(); it != d_ready.end();) {
-            assert(it->d_deadline == TimePoint::min());
+            Context* ctx = static_cast<Context*>(&*it);
+            assert(ctx->d_deadline == TimePoint::min());
 
+            // contexts becoming ready while the last one runs
+            // are left for the next pass
             auto nextIt = std::next(it);
-            if (!it->resume()) {
+            bool last = nextIt == d_ready.end();
+            d_ready.insert(nextIt, d_cursor);
+
+            if (ctx->d_wokenAt != TimePoint::min()) {
+                recordLatency(ctx);
+            }
+            Context* back = ctx->resume();
+            bump<uint64_t>(d_metrics.switches);
+            if (back->d_finished) {
                 // move finished context to the list to be reused
-                d_unused.splice(d_unused.begin(), d_ready, it);
+                d_unused.splice(d_unused.begin(), d_ready, d_ready.iterator_to(*back));
+                bump<uint64_t>(d_metrics.finished);
             }
 
-            it = nextIt;
+            it = d_ready.erase(d_ready.iterator_to(d_cursor));
+            if (last)
+                break;
         }
 
-        // if all lists are empty, then there is no more work
-        if (d_ready.empty() && d_sleeping.empty() && d_disabled.empty())
+        // one write per corked connection for everything queued above
+        flushDirty();
+
+        // if all lists are empty, then there is no more work,
+        // corked output blocked by a full socket is polled for
+        if (d_ready.empty() && d_sleeping.empty() && d_disabled.empty()
+                && d_dirty.empty()
+                && d_posted.load(std::memory_order_relaxed) == nullptr) {
+            publishMetrics(Clock::now());
             break;
+        }
+
+        if (d_ring) {
+            // one submission for everything queued during this iteration
+            d_ring->submit();
+            d_ring->reap();
+        }
+
+        if (d_fileRing) {
+            d_fileRing->submit();
+            d_fileRing->reap();
+        }
+
+        int64_t pollerTimeout = 0;
+        if (d_ready.empty()) {
+            pollerTimeout = d_sleeping.empty() ? 
+                -1 : nsToDeadline(d_sleeping.top()->d_deadline);
+        }
+
+        pollStart = Clock::now();
+        publishMetrics(pollStart);
 
-        int pollerTimeout = d_ready.empty() ? msToDeadline(d_deadline) : 0;
         int n = d_poller.wait(pollerTimeout);
+        bump<uint64_t>(d_metrics.polls);
+        if (n > 0) {
+            bump<uint64_t>(d_metrics.events, n);
+        }
+    }
+}
+
+void Dispatcher::publishMetrics(TimePoint end)
+{
+    int64_t ns = DurationNano(end - d_now).count();
+    bump<uint64_t>(d_metrics.runningNs, ns);
+    bump<uint64_t>(d_metrics.loops[loopBucket(ns)]);
+
+    set(d_metrics.ready, d_ready.size());
+    set(d_metrics.sleeping, d_sleeping.size());
+    set(d_metrics.disabled, d_disabled.size());
+    set(d_metrics.unused, d_unused.size());
+}
+
+void Dispatcher::countSwitch(Context* next)
+{
+    bump<uint64_t>(d_metrics.switches);
+    if (next->d_wokenAt != TimePoint::min()) {
+        recordLatency(next);
+    }
+}
+
+void Dispatcher::recordLatency(Context* ctx)
+{
+    int64_t ns = DurationNano(Clock::now() - ctx->d_wokenAt).count();
+    ctx->d_wokenAt = TimePoint::min();
+
+    d_latency.record(ns);
+    if (ctx->d_latencyTag != nullptr) {
+        ctx->d_latencyTag->record(ns);
+    }
+}
+
+const LatencyHistogram* Dispatcher::latency(const std::string& tag) const
+{
+    auto it = d_taggedLatency.find(tag);
+    return it == d_taggedLatency.end() ? nullptr : &it->second;
+}
+
+void Dispatcher::resetLatency()
+{
+    d_latency.reset();
+    for (auto& tagged : d_taggedLatency) {
+        tagged.second.reset();
+    }
+}
+
+DispatcherStats Dispatcher::stats() const
+{
+    const auto relaxed = std::memory_order_relaxed;
+
+    DispatcherStats st;
+    st.switches = d_metrics.switches.load(relaxed);
+    st.spawns = d_metrics.spawns.load(relaxed);
+    st.finished = d_metrics.finished.load(relaxed);
+    st.ready = d_metrics.ready.load(relaxed);
+    st.sleeping = d_metrics.sleeping.load(relaxed);
+    st.disabled = d_metrics.disabled.load(relaxed);
+    st.unused = d_metrics.unused.load(relaxed);
+    st.polls = d_metrics.polls.load(relaxed);
+    st.events = d_metrics.events.load(relaxed);
+    st.blockedNs = d_metrics.blockedNs.load(relaxed);
+    st.runningNs = d_metrics.runningNs.load(relaxed);
+    for (std::size_t i = 0; i < DispatcherStats::LOOP_BUCKETS; ++i) {
+        st.loops[i] = d_metrics.loops[i].load(relaxed);
+    }
+    return st;
+}
+
+void Dispatcher::scheduleFlush(Flushable& f)
+{
+    if (!f.is_linked())
+        d_dirty.push_back(f);
+}
+
+void Dispatcher::flushDirty()
+{
+    for (auto it = d_dirty.begin(); it != d_dirty.end();) {
+        Flushable& f = *it++;
+        // blocked ones stay in the list, the poller wakes up once
+        // they are writable and they are retried
+        if (f.flushPending(d_poller))
+            f.unlink();
     }
 }
 
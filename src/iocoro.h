@@ -1,12 +1,21 @@
 #pragma once
 
+#include "iobuffer.h"
 #include "iocommon.h"
+#include "iohistogram.h"
 #include "iopoll.h"
+#include "iostack.h"
 
+#include <atomic>
 #include <chrono>
+#include <cstddef>
 #include <functional>
 #include <list>
+#include <map>
 #include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include <boost/context/continuation.hpp>
 #include <boost/pool/object_pool.hpp>
@@ -22,21 +31,66 @@ typedef std::chrono::duration<int64_t, std::nano> DurationNano;
 
 class Dispatcher;
 class Context;
+class IoUring;
 
 namespace Flags
 {
     const uint32_t None = 0;
     // Wake flags
-    const uint32_t Interrupt  = 0x100; // break execution
-    const uint32_t Schedule   = 0x200; // scheduled wake
+    const uint32_t Interrupt  = 0x100; // break execution, see Context::interrupt()
+    const uint32_t Schedule   = 0x200; // woken by its deadline
 };
 
+// syscall counters of a ContextPoll
+struct PollStats
+{
+    // poller registration changes (epoll_ctl)
+    uint32_t pollerCalls{0};
+    // suspensions after an operation reported EAGAIN
+    uint32_t waits{0};
+};
+
+// Queued waiting context, used by ContextPoll and WaitQueue. Lives on
+// the waiter's stack and unlinks itself on timeout or interrupt.
+struct WaitNode: public boost::intrusive::list_base_hook<
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink>>
+{
+    explicit WaitNode(Context* c) : ctx(c) {}
+
+    Context* ctx;
+    // dequeued by the waker
+    bool notified{false};
+};
+
+typedef boost::intrusive::list<WaitNode,
+        boost::intrusive::constant_time_size<false>> WaitNodeList;
+
+// Waits for readiness of an fd. The fd is registered with the poller
+// lazily, on the first wait, so fds that never block cost no poller
+// syscalls.
+//
+// Several contexts may wait for the same direction, they queue up in
+// FIFO order. An edge wakes the first waiter, once it runs the next
+// one is woken too while the fd is still considered ready, i.e. until
+// some context comes back to wait after EAGAIN.
 class ContextPoll: FilePoll
 {
-    Context* readContext{nullptr};
-    Context* writeContext{nullptr};
+    struct Direction
+    {
+        WaitNodeList waiters;
+        // set by an edge, cleared when a context has seen EAGAIN
+        bool ready{false};
+    };
+
+    Direction d_read;
+    Direction d_write;
+    Direction d_error;
+    bool d_registered{false};
+    PollStats d_stats;
 
     virtual void handleEvents(uint32_t events) override;
+    static void wakeFirst(Direction& dir);
+    int wait(Direction& dir, Clock::time_point deadline);
 
 public:
     ContextPoll(int fd = -1);
@@ -44,8 +98,18 @@ public:
 
     void add(int fd);
     void remove();
-    void waitRead();
-    void waitWrite();
+    // like remove(), but without a syscall, for an fd closed right after
+    void release();
+    // registers the fd now, so that it is polled without a waiter,
+    // the poller is passed in as the dispatcher calls it outside contexts
+    void arm(Poller& poller);
+    const PollStats& stats() const { return d_stats; }
+    // Return 0 when the event fires, ETIMEDOUT once deadline passes or
+    // ECANCELED if the context is interrupted.
+    int waitRead(Clock::time_point deadline = Clock::time_point::max());
+    int waitWrite(Clock::time_point deadline = Clock::time_point::max());
+    // waits for EventType::Error
+    int waitError(Clock::time_point deadline = Clock::time_point::max());
 
     // move
     ContextPoll(ContextPoll&& ctx);
@@ -56,21 +120,131 @@ public:
     ContextPoll& operator = (const ContextPoll&) = delete;
 };
 
+// Output buffered in user space and sent by the dispatcher once per
+// loop iteration right before it polls, see Dispatcher::scheduleFlush()
+class Flushable: public boost::intrusive::list_base_hook<
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink>>
+{
+public:
+    virtual ~Flushable() {}
+    // writes without blocking, returns false if data is left, the
+    // dispatcher's poller is armed for the rest
+    virtual bool flushPending(Poller& poller) = 0;
+};
+
+// Move-only callable wrapper for context entry functions.
+// Callables up to CAPACITY bytes are stored inline, bigger ones
+// fall back to the heap.
+class InlineTask
+{
+public:
+    static const std::size_t CAPACITY = 64;
+
+private:
+    typedef void (*InvokeFn)(void*);
+    typedef void (*DestroyFn)(void*);
+
+    template <class F>
+    struct InlineOps
+    {
+        static void invoke(void* p) { (*static_cast<F*>(p))(); }
+        static void destroy(void* p) { static_cast<F*>(p)->~F(); }
+    };
+
+    template <class F>
+    struct HeapOps
+    {
+        static void invoke(void* p) { (**static_cast<F**>(p))(); }
+        static void destroy(void* p) { delete *static_cast<F**>(p); }
+    };
+
+    typename std::aligned_storage<CAPACITY, alignof(std::max_align_t)>::type d_storage;
+    InvokeFn d_invoke{nullptr};
+    DestroyFn d_destroy{nullptr};
+
+public:
+    InlineTask() = default;
+    ~InlineTask() { reset(); }
+
+    template <class F>
+    void assign(F&& f)
+    {
+        typedef typename std::decay<F>::type Fn;
+        typedef std::integral_constant<bool, 
+                sizeof(Fn) <= CAPACITY && alignof(Fn) <= alignof(std::max_align_t)> FitsInline;
+
+        reset();
+        emplace<Fn>(std::forward<F>(f), FitsInline());
+    }
+
+private:
+    template <class Fn, class F>
+    void emplace(F&& f, std::true_type)
+    {
+        new (&d_storage) Fn(std::forward<F>(f));
+        d_invoke = &InlineOps<Fn>::invoke;
+        d_destroy = &InlineOps<Fn>::destroy;
+    }
+
+    template <class Fn, class F>
+    void emplace(F&& f, std::false_type)
+    {
+        new (&d_storage) Fn*(new Fn(std::forward<F>(f)));
+        d_invoke = &HeapOps<Fn>::invoke;
+        d_destroy = &HeapOps<Fn>::destroy;
+    }
+
+public:
+    void reset()
+    {
+        if (d_destroy != nullptr) {
+            d_destroy(&d_storage);
+            d_invoke = nullptr;
+            d_destroy = nullptr;
+        }
+    }
+
+    void operator () () { d_invoke(&d_storage); }
+    explicit operator bool () const { return d_invoke != nullptr; }
+
+    // noncopyable
+    InlineTask(const InlineTask&) = delete;
+    InlineTask& operator = (const InlineTask&) = delete;
+};
+
+// Link of a Context in the dispatcher's scheduling lists. A bare link
+// marks the dispatcher's position in the ready list, see d_cursor.
+struct ContextLink: public boost::intrusive::list_base_hook<>
+{
+};
+
+typedef boost::intrusive::list<ContextLink> ContextList;
+
 class Context: 
-    public boost::intrusive::list_base_hook<>
+    public ContextLink
 {
     friend class Dispatcher;
+    friend class TimerHeap;
 
     Dispatcher& d_dispatcher;
-    std::function<void()> d_entry;
+    InlineTask d_entry;
     boost::context::continuation d_coro;
     bool d_finished = false;
     Clock::time_point d_deadline{Clock::time_point::min()};
+    std::size_t d_timerIndex{0}; // position in TimerHeap while sleeping
     uint32_t d_wakeFlags{Flags::None};
+    // cross-thread wakeup queue link
+    std::atomic<bool> d_remoteWake{false};
+    Context* d_nextRemote{nullptr};
+    // when it became ready, min if not tracked, see Dispatcher::trackLatency()
+    TimePoint d_wokenAt{TimePoint::min()};
+    LatencyHistogram* d_latencyTag{nullptr};
 
     void cc();
-    bool resume(uint32_t flags = Flags::None);
-    void init(std::function<void()>&& entry);
+    // returns context that switched back to the dispatcher,
+    // it differs from this one after switchTo()
+    Context* resume(uint32_t flags = Flags::None);
+    void init();
 
 public:
     Context(Dispatcher& dispatcher) 
@@ -80,67 +254,496 @@ public:
     void disable();
     void enable();
     void schedule(Clock::time_point deadline);
+    // same as enable(), but safe to call from any thread,
+    // context must re-check the condition it waits for after waking up
+    void wakeFromAnyThread();
     Dispatcher& dispatcher() { return d_dispatcher; }
 
+    // Wakes the context from an interruptible wait (socket I/O, see
+    // ContextPoll, or a WaitQueue), which fails with ECANCELED then. If the context is
+    // not waiting, its next interruptible wait fails right away.
+    void interrupt();
+    // wake latency of this context is recorded under tag as well,
+    // see Dispatcher::latency()
+    void setLatencyTag(const std::string& tag);
+
     static Context* self();
+    // returns wake flags of the current context, e.g. Flags::Schedule
+    // if it was woken by its deadline
     static uint32_t yield();
+    // clears pending interrupt of the current context,
+    // returns true if there was one
+    static bool clearInterrupt();
+    // Enables next and switches to it directly, without a pass through
+    // the dispatcher. The calling context keeps its state, so if it is
+    // ready it runs again on the next dispatcher pass. Falls back to
+    // yield() if next can not be switched to.
+    static void switchTo(Context* next);
+    // sleeps are not interruptible, the context sleeps until t even
+    // if woken earlier, a pending interrupt fails the next wait
     static void sleep_for(Clock::duration d);
     static void sleep_until(Clock::time_point t);
 };
 
-class Event
+// FIFO of waiting contexts. WaitNodes live on the waiters' stacks
+// and unlink themselves when wait() returns, so adding and removing
+// a waiter is O(1), including removal on timeout.
+class WaitQueue
 {
-    struct WaiterNode {
-        Context* ctx;
-        WaiterNode* next;
-    };
+    WaitNodeList d_waiters;
+
+public:
+    // Suspends current context until it is dequeued, deadline passes
+    // or the context is interrupted. Returns true if dequeued, false
+    // with errno ETIMEDOUT or ECANCELED otherwise.
+    bool wait(Clock::time_point deadline = Clock::time_point::max());
+
+    // removes first waiter, the caller is responsible for waking
+    // the returned context up, nullptr if there are no waiters
+    Context* dequeue();
+    // dequeues and enables all waiters
+    void notifyAll();
+
+    bool empty() const { return d_waiters.empty(); }
+};
 
-    WaiterNode* d_begin{nullptr};
-    WaiterNode* d_end{nullptr};
+class Event
+{
+    WaitQueue d_waiters;
     bool d_signalled{false};
 
     void notify(bool one);
-    void addWaiter(WaiterNode& node);
 
 public:
     void notify_one();
     void notify_all();
-    void wait();
+    // false if interrupted
+    bool wait();
+    // returns false on timeout or interrupt
     bool wait_for(Clock::duration d);
 };
 
+class ChannelBase;
+
+// One operation of select(), see Channel::sendCase()/recvCase()
+struct ChannelCase
+{
+    ChannelBase* channel;
+    void* value;
+    bool send;
+    // set to false if the case completed because channel is closed
+    bool* ok;
+};
+
+// Type independent part of Channel: waiter queues, close and select.
+class ChannelBase
+{
+public:
+    struct Selector
+    {
+        Context* ctx;
+        int fired;
+    };
+
+    // one per case of a waiting select, lives on the waiter's stack
+    struct Waiter: public boost::intrusive::list_base_hook<>
+    {
+        Selector* selector{nullptr};
+        int index{0};
+        void* value{nullptr};
+        bool ok{false};
+    };
+
+    // Completes the first case that can proceed without waiting,
+    // otherwise waits for one until deadline. Returns case index,
+    // -1 on timeout. waiters must have space for count entries.
+    static int select(ChannelCase* cases, Waiter* waiters, std::size_t count,
+            Clock::time_point deadline);
+
+    // wakes all waiters, pending and later sends fail,
+    // receives drain buffered values and fail then
+    void close();
+    bool closed() const { return d_closed; }
+
+    // noncopyable
+    ChannelBase(const ChannelBase&) = delete;
+    ChannelBase& operator = (const ChannelBase&) = delete;
+
+protected:
+    typedef boost::intrusive::list<Waiter> WaitList;
+
+    WaitList d_senders;
+    WaitList d_receivers;
+    bool d_closed{false};
+
+    ChannelBase() = default;
+    ~ChannelBase();
+
+    // first waiter whose select has not completed yet, unlinked
+    Waiter* popWaiter(WaitList& list);
+    // completes w and wakes up its context
+    static void fire(Waiter& w, bool ok);
+
+    // move value to a receiver or buffer, false if it has to wait
+    virtual bool trySend(void* value) = 0;
+    // move value from a sender or buffer, false if it has to wait
+    virtual bool tryRecv(void* value) = 0;
+
+private:
+    bool tryComplete(ChannelCase& c);
+};
+
+// Go-style channel between contexts of one dispatcher.
+// With zero capacity send and recv rendezvous, the value is moved
+// straight from the sender's variable into the receiver's one.
+// Otherwise up to capacity values are buffered in a ring.
+template <class T>
+class Channel: public ChannelBase
+{
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+    std::unique_ptr<Slot[]> d_buffer;
+    std::size_t d_capacity;
+    std::size_t d_head{0};
+    std::size_t d_size{0};
+
+    T& at(std::size_t i) { return *reinterpret_cast<T*>(&d_buffer[i]); }
+
+    void push(T&& value)
+    {
+        new (&at((d_head + d_size) % d_capacity)) T(std::move(value));
+        ++d_size;
+    }
+
+    void pop(T& value)
+    {
+        T& front = at(d_head);
+        value = std::move(front);
+        front.~T();
+        d_head = (d_head + 1) % d_capacity;
+        --d_size;
+    }
+
+    virtual bool trySend(void* p) override
+    {
+        T& value = *static_cast<T*>(p);
+
+        if (Waiter* w = popWaiter(d_receivers)) {
+            *static_cast<T*>(w->value) = std::move(value);
+            fire(*w, true);
+            return true;
+        }
+
+        if (d_size < d_capacity) {
+            push(std::move(value));
+            return true;
+        }
+
+        return false;
+    }
+
+    virtual bool tryRecv(void* p) override
+    {
+        T& value = *static_cast<T*>(p);
+
+        if (d_size > 0) {
+            pop(value);
+            // buffer has space now, take value of the first blocked sender
+            if (Waiter* w = popWaiter(d_senders)) {
+                push(std::move(*static_cast<T*>(w->value)));
+                fire(*w, true);
+            }
+            return true;
+        }
+
+        if (Waiter* w = popWaiter(d_senders)) {
+            value = std::move(*static_cast<T*>(w->value));
+            fire(*w, true);
+            return true;
+        }
+
+        return false;
+    }
+
+public:
+    explicit Channel(std::size_t capacity = 0)
+        : d_buffer(capacity ? new Slot[capacity] : nullptr), d_capacity(capacity) {}
+
+    ~Channel()
+    {
+        while (d_size > 0) {
+            at(d_head).~T();
+            d_head = (d_head + 1) % d_capacity;
+            --d_size;
+        }
+    }
+
+    // false if channel is closed, value is not moved from then
+    bool send(T value)
+    {
+        bool ok = false;
+        ChannelCase c = sendCase(value, &ok);
+        Waiter w;
+        select(&c, &w, 1, Clock::time_point::max());
+        return ok;
+    }
+
+    // false if channel is closed and drained
+    bool recv(T& value)
+    {
+        bool ok = false;
+        ChannelCase c = recvCase(value, &ok);
+        Waiter w;
+        select(&c, &w, 1, Clock::time_point::max());
+        return ok;
+    }
+
+    // value must stay alive until select() returns
+    ChannelCase sendCase(T& value, bool* ok = nullptr)
+    {
+        return ChannelCase{this, &value, true, ok};
+    }
+
+    ChannelCase recvCase(T& value, bool* ok = nullptr)
+    {
+        return ChannelCase{this, &value, false, ok};
+    }
+
+    std::size_t size() const { return d_size; }
+    std::size_t capacity() const { return d_capacity; }
+};
+
+// Waits until one of the channel cases completes, returns its index.
+// If several can proceed at once, the first one in order is taken.
+template <class... Cases>
+int select(Cases... cases)
+{
+    ChannelCase c[] = {cases...};
+    ChannelBase::Waiter w[sizeof...(Cases)];
+    return ChannelBase::select(c, w, sizeof...(Cases), Clock::time_point::max());
+}
+
+// same as select(), returns -1 on timeout
+template <class... Cases>
+int select_for(Clock::duration timeout, Cases... cases)
+{
+    ChannelCase c[] = {cases...};
+    ChannelBase::Waiter w[sizeof...(Cases)];
+    return ChannelBase::select(c, w, sizeof...(Cases), Clock::now() + timeout);
+}
+
+// 4-ary min-heap of sleeping contexts ordered by deadline.
+// Every context keeps its own position in the heap, so it can be
+// removed or rescheduled without searching.
+class TimerHeap
+{
+    std::vector<Context*> d_heap;
+
+    void place(std::size_t i, Context* ctx);
+    void siftUp(std::size_t i);
+    void siftDown(std::size_t i);
+
+public:
+    bool empty() const { return d_heap.empty(); }
+    std::size_t size() const { return d_heap.size(); }
+    Context* top() const { return d_heap.front(); }
+
+    void push(Context* ctx);
+    void remove(Context* ctx);
+    // restore heap order after context's deadline has changed
+    void update(Context* ctx);
+};
+
+// Counters of a Dispatcher, see Dispatcher::stats()
+struct DispatcherStats
+{
+    static const std::size_t LOOP_BUCKETS = 24;
+
+    uint64_t switches{0};       // contexts resumed
+    uint64_t spawns{0};
+    uint64_t finished{0};
+    // list sizes at the end of the last loop iteration
+    std::size_t ready{0};
+    std::size_t sleeping{0};
+    std::size_t disabled{0};
+    std::size_t unused{0};
+    uint64_t polls{0};          // Poller::wait() calls
+    uint64_t events{0};         // events returned by them
+    uint64_t blockedNs{0};      // time spent in Poller::wait()
+    uint64_t runningNs{0};      // time spent out of it
+    // Loop iterations by time spent running: bucket 0 counts iterations
+    // under 1us, bucket i under 2^i us, the last one all longer ones
+    uint64_t loops[LOOP_BUCKETS]{};
+};
+
+// Work done by another thread for a waiting context. The dispatcher
+// sets done and enables ctx, so once it is queued with
+// Dispatcher::completeRemote() the other thread must not touch it.
+struct RemoteCompletion
+{
+    Context* ctx{nullptr};
+    bool done{false};
+    RemoteCompletion* next{nullptr};
+};
+
 class Dispatcher
 {
+    struct PostedTask
+    {
+        PostedTask* next;
+        std::function<void()> fn;
+    };
+
+    // receives wakeups posted from other threads
+    class RemotePoll: public FilePoll
+    {
+        Dispatcher& d_dispatcher;
+        virtual void handleEvents(uint32_t events) override;
+    public:
+        RemotePoll(Dispatcher& d, int fd) : FilePoll(fd), d_dispatcher(d) {}
+    };
+
+    // must outlive contexts, their stacks are released on destruction
+    StackAllocator d_stacks;
+    BufferPool d_buffers;
     boost::object_pool<Context> d_pool;
 
     // Internal time
     TimePoint d_now{TimePoint::min()};
-    TimePoint d_deadline{TimePoint::max()};
     
     // scheduling lists
-    boost::intrusive::list<Context> d_ready;
-    boost::intrusive::list<Context> d_sleeping;
-    boost::intrusive::list<Context> d_disabled;
-    boost::intrusive::list<Context> d_unused;
+    ContextList d_ready;
+    TimerHeap d_sleeping;
+    ContextList d_disabled;
+    ContextList d_unused;
+    // Marks the position in d_ready while a context runs. Contexts it
+    // switches to may finish or leave the list, so their neighbours
+    // can not be used to move on.
+    ContextLink d_cursor;
+    // corked output waiting for the end of the iteration
+    boost::intrusive::list<Flushable,
+        boost::intrusive::constant_time_size<false>> d_dirty;
 
     Poller d_poller;
+    // optional completion-based backend, see useIoUring()
+    std::unique_ptr<IoUring> d_ring;
+    // only for file I/O while sockets use the poller, see getFileRing()
+    std::unique_ptr<IoUring> d_fileRing;
+    bool d_fileRingProbed{false};
     bool d_stop;
 
-    boost::intrusive::list<Context>& 
-        getListByDeadline(const Clock::time_point& deadline);
+    // lock-free stacks filled by other threads
+    std::atomic<PostedTask*> d_posted{nullptr};
+    std::atomic<Context*> d_remoteWoken{nullptr};
+    std::atomic<RemoteCompletion*> d_remoteCompleted{nullptr};
+    // set while eventfd is signalled, so a burst costs one write
+    std::atomic<bool> d_remotePending{false};
+    WakeupFd d_remoteFd;
+    RemotePoll d_remotePoll{*this, d_remoteFd.handle()};
+
+    // written by the dispatcher thread only, read by stats()
+    struct Metrics
+    {
+        std::atomic<uint64_t> switches{0};
+        std::atomic<uint64_t> spawns{0};
+        std::atomic<uint64_t> finished{0};
+        std::atomic<std::size_t> ready{0};
+        std::atomic<std::size_t> sleeping{0};
+        std::atomic<std::size_t> disabled{0};
+        std::atomic<std::size_t> unused{0};
+        std::atomic<uint64_t> polls{0};
+        std::atomic<uint64_t> events{0};
+        std::atomic<uint64_t> blockedNs{0};
+        std::atomic<uint64_t> runningNs{0};
+        std::atomic<uint64_t> loops[DispatcherStats::LOOP_BUCKETS]{};
+    };
+    Metrics d_metrics;
+
+    // wake-to-run latency, see trackLatency()
+    bool d_trackLatency{false};
+    LatencyHistogram d_latency;
+    std::map<std::string, LatencyHistogram> d_taggedLatency;
+
+    ContextList& getListByDeadline(const Clock::time_point& deadline);
+    Context* acquireContext();
+    void start(Context* ctx);
+    void signalRemote();
+    void handleRemote();
+    void flushDirty();
+    // accounts the loop iteration that started at d_now
+    void publishMetrics(TimePoint end);
+    void recordLatency(Context* ctx);
 
 public:
-    Dispatcher();
+    explicit Dispatcher(const StackPolicy& stackPolicy = StackPolicy());
     ~Dispatcher();
 
-    void spawn(std::function<void()>&& f);
+    // f is stored inside the pooled context, so spawning small
+    // callables does not allocate
+    template <class F>
+    void spawn(F&& f)
+    {
+        Context* ctx = acquireContext();
+        ctx->d_entry.assign(std::forward<F>(f));
+        start(ctx);
+    }
+
+    // like spawn, but does not yield to the new context,
+    // use it to start a batch of contexts at once
+    template <class F>
+    void spawnDeferred(F&& f)
+    {
+        Context* ctx = acquireContext();
+        ctx->d_entry.assign(std::forward<F>(f));
+        d_ready.push_back(*ctx);
+    }
+
+    // spawns f in this dispatcher, safe to call from any thread
+    // while the dispatcher is alive
+    void post(std::function<void()>&& f);
+    // queues c, safe to call from any thread
+    void completeRemote(RemoteCompletion& c);
     void dispatch();
     void stop();
 
+    // Switches socket operations of this dispatcher to io_uring.
+    // Returns false if not supported by the build or the kernel.
+    // Setting IOCORO_IO_URING environment variable enables it by default.
+    bool useIoUring(unsigned entries = 256, bool registerFiles = false);
+
+    StackStats stackStats() const { return d_stacks.stats(); }
+    // Safe to call from any thread, it only reads relaxed atomics,
+    // so the fields may be from different loop iterations.
+    DispatcherStats stats() const;
+
+    // Wake-to-run latency: time from enable() or a timer firing until
+    // the context runs. Off by default, when on it costs two clock
+    // reads per wakeup. Histograms are read on the dispatcher thread.
+    void trackLatency(bool on) { d_trackLatency = on; }
+    const LatencyHistogram& latency() const { return d_latency; }
+    // contexts tagged by Context::setLatencyTag(), nullptr if none
+    const LatencyHistogram* latency(const std::string& tag) const;
+    void resetLatency();
+    // release memory of pooled stacks that are not in use
+    void trimStacks() { d_stacks.trim(); }
+
     // internal
     void schedule(Context* ctx, const Clock::time_point& deadline);
+    // f is flushed before the next poll, until then or until it
+    // unlinks itself repeated calls are no-ops
+    void scheduleFlush(Flushable& f);
+    void wakeRemote(Context* ctx);
+    // accounts a switch to next that did not go through the dispatcher
+    void countSwitch(Context* next);
+    LatencyHistogram& taggedLatency(const std::string& tag) { return d_taggedLatency[tag]; }
     ContextPoll getPoll(int fd);
     Poller& getPoller() { return d_poller; }
+    IoUring* getIoUring() { return d_ring.get(); }
+    // Ring for AsyncFile: the one of useIoUring() if enabled, otherwise
+    // a ring of its own created on first use. nullptr if not supported.
+    IoUring* getFileRing();
+    StackAllocator& getStackAllocator() { return d_stacks; }
+    BufferPool& getBufferPool() { return d_buffers; }
 };
 
 inline Poller& getCurrentPoller()
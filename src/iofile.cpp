@@ -0,0 +1,128 @@
+#include "iofile.h"
+#include "iooffload.h"
+#include "iouring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace iocoro
+{
+
+namespace {
+
+const std::size_t FILE_THREADS = 4;
+
+// separate from OffloadPool::instance(), so file I/O does not queue
+// behind unrelated blocking calls
+OffloadPool& filePool()
+{
+    static OffloadPool pool(FILE_THREADS);
+    return pool;
+}
+
+// runs syscall f on the file pool, errno is carried back
+template <class F>
+auto blockingCall(F&& f) -> decltype(f())
+{
+    int err = 0;
+    auto r = filePool().run([&] {
+        auto r = f();
+        err = errno;
+        return r;
+    });
+
+    if (r < 0)
+        errno = err;
+    return r;
+}
+
+#ifdef IOCORO_WITH_URING
+
+// ring of the current dispatcher, created on first use
+IoUring* fileRing()
+{
+    Context* ctx = Context::self();
+    return ctx ? ctx->dispatcher().getFileRing() : nullptr;
+}
+
+// converts negative errno of completion to -1/errno
+int ringResult(int r)
+{
+    if (r < 0) {
+        errno = -r;
+        return -1;
+    }
+    return r;
+}
+
+#endif
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+// class AsyncFile
+//////////////////////////////////////////////////////////////////////////
+int AsyncFile::open(const char* path, int flags, mode_t mode)
+{
+    // opening may block on a slow disk as well
+    int fd = blockingCall([&] { return ::open(path, flags | O_CLOEXEC, mode); });
+    if (fd < 0)
+        return errno;
+
+    d_handle = FileHandle(fd);
+    return 0;
+}
+
+void AsyncFile::close()
+{
+    d_handle.close();
+}
+
+ssize_t AsyncFile::pread(void* buf, std::size_t len, uint64_t offset)
+{
+#ifdef IOCORO_WITH_URING
+    if (IoUring* ring = fileRing()) {
+        IoUring::Op op;
+        ring->read(op, d_handle, buf, len, offset);
+        return ringResult(ring->wait(op));
+    }
+#endif
+
+    return blockingCall([&] { return ::pread(d_handle, buf, len, offset); });
+}
+
+ssize_t AsyncFile::pwrite(const void* buf, std::size_t len, uint64_t offset)
+{
+#ifdef IOCORO_WITH_URING
+    if (IoUring* ring = fileRing()) {
+        IoUring::Op op;
+        ring->write(op, d_handle, buf, len, offset);
+        return ringResult(ring->wait(op));
+    }
+#endif
+
+    return blockingCall([&] { return ::pwrite(d_handle, buf, len, offset); });
+}
+
+int AsyncFile::fsync(bool dataOnly)
+{
+#ifdef IOCORO_WITH_URING
+    if (IoUring* ring = fileRing()) {
+        IoUring::Op op;
+        ring->fsync(op, d_handle, dataOnly);
+        return ringResult(ring->wait(op));
+    }
+#endif
+
+#ifdef __APPLE__
+    // no fdatasync on macOS
+    dataOnly = false;
+#endif
+
+    return blockingCall([&] {
+        return dataOnly ? ::fdatasync(d_handle) : ::fsync(d_handle);
+    });
+}
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "iocoro.h"
+
+#include <sys/types.h>
+
+namespace iocoro
+{
+
+// Regular file accessed without blocking the dispatcher. Operations
+// suspend the calling context and go through io_uring, the one of
+// Dispatcher::useIoUring() or one created for files on first use, so
+// reads issued by many contexts during one loop iteration are submitted
+// together. Only if io_uring is not available they run on a small
+// dedicated OffloadPool.
+class AsyncFile
+{
+    FileHandle d_handle;
+
+public:
+    AsyncFile(int fd = -1) : d_handle(fd) {}
+
+    // returns 0 if success, error otherwise
+    int open(const char* path, int flags, mode_t mode = 0644);
+    void close();
+
+    int handle() const { return d_handle; }
+
+    // return size transferred, -1 on error with errno set
+    ssize_t pread(void* buf, std::size_t len, uint64_t offset);
+    ssize_t pwrite(const void* buf, std::size_t len, uint64_t offset);
+    // return 0 if success, -1 on error with errno set
+    int fsync(bool dataOnly = false);
+};
+
+}
@@ -0,0 +1,80 @@
+#include "iohistogram.h"
+
+#include <algorithm>
+
+namespace iocoro
+{
+
+LatencyHistogram::LatencyHistogram()
+: d_buckets(BUCKETS)
+{
+}
+
+std::size_t LatencyHistogram::bucketOf(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+        return value;
+
+    unsigned exp = 63 - __builtin_clzll(value);
+    std::size_t sub = (value >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (exp - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::upperBound(std::size_t i)
+{
+    if (i < SUB_BUCKETS)
+        return i;
+
+    unsigned exp = i / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t sub = i % SUB_BUCKETS;
+    uint64_t lower = (SUB_BUCKETS + sub) << (exp - SUB_BITS);
+    return lower + (uint64_t(1) << (exp - SUB_BITS)) - 1;
+}
+
+void LatencyHistogram::record(int64_t value)
+{
+    if (value < 0)
+        value = 0;
+
+    ++d_buckets[bucketOf(value)];
+    ++d_count;
+    d_max = std::max(d_max, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (std::size_t i = 0; i < BUCKETS; ++i) {
+        d_buckets[i] += other.d_buckets[i];
+    }
+    d_count += other.d_count;
+    d_max = std::max(d_max, other.d_max);
+}
+
+void LatencyHistogram::reset()
+{
+    std::fill(d_buckets.begin(), d_buckets.end(), 0);
+    d_count = 0;
+    d_max = 0;
+}
+
+int64_t LatencyHistogram::percentile(double q) const
+{
+    if (d_count == 0)
+        return 0;
+
+    // rank of the value, counted from 1
+    uint64_t rank = static_cast<uint64_t>(q * d_count + 0.5);
+    rank = std::min(std::max<uint64_t>(rank, 1), d_count);
+
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < BUCKETS; ++i) {
+        seen += d_buckets[i];
+        if (seen >= rank) {
+            return std::min<int64_t>(upperBound(i), d_max);
+        }
+    }
+
+    return d_max;
+}
+
+}
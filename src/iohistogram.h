@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace iocoro
+{
+
+// Log-linear histogram in the style of HdrHistogram: every power of two
+// range is split into 16 buckets, so values of any magnitude are kept
+// with about 6% precision in a fixed amount of memory. Not thread-safe.
+class LatencyHistogram
+{
+    static const unsigned SUB_BITS = 4;
+    static const std::size_t SUB_BUCKETS = 1 << SUB_BITS;
+    // values below SUB_BUCKETS get a bucket each, above that every
+    // power of two up to 2^63 gets SUB_BUCKETS
+    static const std::size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    std::vector<uint64_t> d_buckets;
+    uint64_t d_count{0};
+    int64_t d_max{0};
+
+    static std::size_t bucketOf(uint64_t value);
+    // highest value counted by bucket i
+    static uint64_t upperBound(std::size_t i);
+
+public:
+    LatencyHistogram();
+
+    // negative values are counted as 0
+    void record(int64_t value);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t count() const { return d_count; }
+    int64_t max() const { return d_max; }
+    // value not exceeded by fraction q of recorded values,
+    // e.g. 0.99 for p99, 0 if nothing was recorded
+    int64_t percentile(double q) const;
+};
+
+}
@@ -0,0 +1,88 @@
+#include "iooffload.h"
+
+namespace iocoro
+{
+
+//////////////////////////////////////////////////////////////////////////
+// class OffloadPool
+//////////////////////////////////////////////////////////////////////////
+OffloadPool::OffloadPool(std::size_t threads)
+{
+    if (threads == 0)
+        threads = 1;
+
+    for (std::size_t i = 0; i < threads; ++i) {
+        d_threads.emplace_back([this] { worker(); });
+    }
+}
+
+OffloadPool::~OffloadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(d_lock);
+        d_stopping = true;
+    }
+    d_cond.notify_all();
+
+    for (auto& t : d_threads) {
+        t.join();
+    }
+}
+
+OffloadPool& OffloadPool::instance()
+{
+    static OffloadPool pool;
+    return pool;
+}
+
+void OffloadPool::execute(Job& job)
+{
+    Context* ctx = Context::self();
+    if (ctx == nullptr) {
+        job.task();
+        return;
+    }
+
+    job.completion.ctx = ctx;
+
+    {
+        std::lock_guard<std::mutex> lock(d_lock);
+        if (d_tail != nullptr) {
+            d_tail->next = &job;
+        } else {
+            d_head = &job;
+        }
+        d_tail = &job;
+    }
+    d_cond.notify_one();
+
+    // done is set by this thread together with enabling ctx,
+    // so nothing of the job is left in flight afterwards
+    while (!job.completion.done) {
+        ctx->disable();
+        Context::yield();
+    }
+}
+
+void OffloadPool::worker()
+{
+    for (;;) {
+        Job* job = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(d_lock);
+            d_cond.wait(lock, [this] { return d_head != nullptr || d_stopping; });
+            if (d_head == nullptr)
+                return;
+
+            job = d_head;
+            d_head = job->next;
+            if (d_head == nullptr)
+                d_tail = nullptr;
+        }
+
+        job->task();
+        job->completion.ctx->dispatcher().completeRemote(job->completion);
+    }
+}
+
+}
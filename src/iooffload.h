@@ -0,0 +1,122 @@
+#pragma once
+#include "iocoro.h"
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+namespace iocoro
+{
+
+// Bounded pool of threads for blocking calls (getaddrinfo, fsync,
+// legacy client libraries). The calling context is suspended while
+// the call runs, so other contexts of its dispatcher keep running.
+// Completion wakes the dispatcher through its remote wakeup fd.
+class OffloadPool
+{
+public:
+    static const std::size_t DEFAULT_THREADS = 4;
+
+    explicit OffloadPool(std::size_t threads = DEFAULT_THREADS);
+    // runs jobs queued so far, then stops threads
+    ~OffloadPool();
+
+    // Runs f on a pool thread and returns its result, exceptions are
+    // rethrown in the calling context. Outside of a context f is
+    // simply called.
+    template <class F>
+    auto run(F&& f) -> decltype(f());
+
+    std::size_t size() const { return d_threads.size(); }
+
+    // pool used by offload(), started on first use
+    static OffloadPool& instance();
+
+    // noncopyable
+    OffloadPool(const OffloadPool&) = delete;
+    OffloadPool& operator = (const OffloadPool&) = delete;
+
+private:
+    // lives on the stack of the waiting context
+    struct Job
+    {
+        InlineTask task;
+        Job* next{nullptr};
+        // queueing it is the pool thread's last touch of the job
+        RemoteCompletion completion;
+    };
+
+    template <class R>
+    struct Result
+    {
+        boost::optional<R> value;
+        std::exception_ptr error;
+
+        template <class F>
+        void call(F& f) { value.emplace(f()); }
+
+        R get()
+        {
+            if (error)
+                std::rethrow_exception(error);
+            return std::move(*value);
+        }
+    };
+
+    std::mutex d_lock;
+    std::condition_variable d_cond;
+    Job* d_head{nullptr};
+    Job* d_tail{nullptr};
+    bool d_stopping{false};
+    std::vector<std::thread> d_threads;
+
+    // queues job and suspends current context until it is done
+    void execute(Job& job);
+    void worker();
+};
+
+template <>
+struct OffloadPool::Result<void>
+{
+    std::exception_ptr error;
+
+    template <class F>
+    void call(F& f) { f(); }
+
+    void get()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+template <class F>
+auto OffloadPool::run(F&& f) -> decltype(f())
+{
+    Result<decltype(f())> result;
+
+    Job job;
+    job.task.assign([&] {
+        try {
+            result.call(f);
+        } catch (...) {
+            result.error = std::current_exception();
+        }
+    });
+    execute(job);
+
+    return result.get();
+}
+
+// runs blocking f on the shared OffloadPool
+template <class F>
+auto offload(F&& f) -> decltype(f())
+{
+    return OffloadPool::instance().run(std::forward<F>(f));
+}
+
+}
@@ -10,6 +10,8 @@ namespace EventType
 {
     const uint32_t Read  = 0x01;
     const uint32_t Write = 0x02;
+    // pending error or error queue entries, e.g. zero-copy completions
+    const uint32_t Error = 0x04;
 }
 
 struct FilePoll
@@ -24,13 +26,25 @@ class Poller
 {
     FileHandle d_efd;
     uint32_t d_count{0};
+#ifdef __linux__
+    // fallback for sub-millisecond timeouts on kernels without epoll_pwait2
+    FileHandle d_timerFd;
+    int waitTimerFd(void* events, int maxEvents, int64_t timeoutNs);
+#endif
 public:
     Poller();
 
     uint32_t count() const { return d_count; }
     void add(FilePoll* pd);
     void remove(FilePoll* pd);
-    int wait(int timeoutMs);
+    // pd moved to another address, points the registration to it
+    void modify(FilePoll* pd);
+    // drops pd without a syscall, its fd must be closed right after,
+    // which removes it from the poller (unless the fd was duplicated)
+    void forget(FilePoll* pd);
+    // timeout in nanoseconds, -1 waits forever,
+    // returns the number of events or -1 on error
+    int wait(int64_t timeoutNs);
 };
 
 }
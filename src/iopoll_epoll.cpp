@@ -1,14 +1,81 @@
 #include "iopoll.h"
 #include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
 
 namespace iocoro
 {
 
+namespace {
+
+const int64_t NS_IN_MS = 1000000;
+const int64_t NS_IN_SEC = 1000000000;
+
+// cleared on the first ENOSYS, kernels before 5.11 lack epoll_pwait2,
+// shared by the pollers of all threads
+std::atomic<bool> s_hasPwait2{true};
+
+timespec toTimespec(int64_t ns)
+{
+    timespec ts;
+    ts.tv_sec = ns / NS_IN_SEC;
+    ts.tv_nsec = ns % NS_IN_SEC;
+    return ts;
+}
+
+int waitPwait2(int efd, epoll_event* events, int maxEvents, int64_t timeoutNs)
+{
+#ifdef SYS_epoll_pwait2
+    if (s_hasPwait2.load(std::memory_order_relaxed)) {
+        timespec ts = toTimespec(timeoutNs);
+        int n = syscall(SYS_epoll_pwait2, efd, events, maxEvents, &ts, nullptr, 0);
+        if (n >= 0 || errno != ENOSYS)
+            return n;
+
+        s_hasPwait2.store(false, std::memory_order_relaxed);
+    }
+#endif
+    errno = ENOSYS;
+    return -1;
+}
+
+}
+
 Poller::Poller() 
     : d_efd(epoll_create1(0)), d_count(0) {}
 
+int Poller::waitTimerFd(void* events, int maxEvents, int64_t timeoutNs)
+{
+    if (d_timerFd == -1) {
+        d_timerFd = FileHandle(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+        if (d_timerFd == -1)
+            return -1;
+
+        // data.ptr == nullptr marks the timer
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = nullptr;
+        if (epoll_ctl(d_efd, EPOLL_CTL_ADD, d_timerFd, &ev) < 0) {
+            d_timerFd.close();
+            return -1;
+        }
+    }
+
+    // rearming replaces a stale expiration left by previous wait
+    itimerspec its{};
+    its.it_value = toTimespec(timeoutNs);
+    if (timerfd_settime(d_timerFd, 0, &its, nullptr) < 0)
+        return -1;
+
+    return epoll_wait(d_efd, static_cast<epoll_event*>(events), maxEvents, -1);
+}
+
 void Poller::add(FilePoll* pd)
 {
     // fprintf(stderr, "Poller: add fd %d\n", pd->fd);
@@ -39,12 +106,37 @@ void Poller::remove(FilePoll* pd)
     --d_count;
 }
 
-int Poller::wait(int timeoutMs)
+void Poller::modify(FilePoll* pd)
+{
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET; 
+    ev.data.ptr = pd;
+    if (epoll_ctl(d_efd, EPOLL_CTL_MOD, pd->fd, &ev) < 0) {
+        fprintf(stderr, "Poller: modify fd %d failed: %d\n", pd->fd, errno);
+    }
+}
+
+void Poller::forget(FilePoll*)
+{
+    --d_count;
+}
+
+int Poller::wait(int64_t timeoutNs)
 {
     const size_t MAXEVENTS = 1024;
     epoll_event events[MAXEVENTS]; 
 
-    int n = epoll_wait(d_efd.handle(), events, MAXEVENTS, timeoutMs);
+    int n = -1;
+    if (timeoutNs <= 0 || timeoutNs % NS_IN_MS == 0) {
+        // whole milliseconds, plain epoll_wait is enough
+        int timeoutMs = timeoutNs < 0 ? -1 : timeoutNs / NS_IN_MS;
+        n = epoll_wait(d_efd.handle(), events, MAXEVENTS, timeoutMs);
+    } else {
+        n = waitPwait2(d_efd, events, MAXEVENTS, timeoutNs);
+        if (n < 0 && errno == ENOSYS) {
+            n = waitTimerFd(events, MAXEVENTS, timeoutNs);
+        }
+    }
 
     if (n == -1) {
         return n;
@@ -53,6 +145,14 @@ int Poller::wait(int timeoutMs)
     for (int i = 0; i < n; ++i) {
         auto& ev = events[i];
 
+        if (ev.data.ptr == nullptr) {
+            // timerfd expired, consume it
+            uint64_t expirations;
+            ssize_t r = ::read(d_timerFd, &expirations, sizeof(expirations));
+            (void)r;
+            continue;
+        }
+
         uint32_t flags = 0;
 
         if (ev.events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
@@ -63,6 +163,10 @@ int Poller::wait(int timeoutMs)
             flags |= EventType::Write;
         }
 
+        if (ev.events & EPOLLERR) {
+            flags |= EventType::Error;
+        }
+
         static_cast<FilePoll*>(ev.data.ptr)->handleEvents(flags);
     }
 
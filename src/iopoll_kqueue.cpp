@@ -11,13 +11,13 @@ namespace {
 
 const int MAX_KQUEUE_EVENTS = 64;
 
-struct timespec *toTimespec(struct timespec *t, int ms)
+struct timespec *toTimespec(struct timespec *t, int64_t ns)
 {
-    if (ms < 0)
+    if (ns < 0)
         return NULL;
 
-    t->tv_sec = ms / 1000;
-    t->tv_nsec = (ms % 1000) * 1000000;
+    t->tv_sec = ns / 1000000000;
+    t->tv_nsec = ns % 1000000000;
 
     return t;
 }
@@ -54,12 +54,30 @@ void Poller::remove(FilePoll* pd)
     --d_count;
 }
 
-int Poller::wait(int timeoutMs)
+void Poller::modify(FilePoll* pd)
+{
+    struct kevent ev[2];
+
+    // EV_ADD of an existing filter updates its udata
+    EV_SET(&ev[0], pd->fd, EVFILT_READ, EV_ADD, 0, 0, pd);
+    EV_SET(&ev[1], pd->fd, EVFILT_WRITE, EV_ADD, 0, 0, pd);
+
+    if (kevent(d_efd, ev, 2, 0, 0, 0) < 0) {
+        fprintf(stderr, "Poller: modify fd %d failed: %d\n", pd->fd, errno);
+    }
+}
+
+void Poller::forget(FilePoll*)
+{
+    --d_count;
+}
+
+int Poller::wait(int64_t timeoutNs)
 {
     struct kevent ev[MAX_KQUEUE_EVENTS];
     struct timespec timeout;
 
-    int n = kevent(d_efd, 0, 0, ev, MAX_KQUEUE_EVENTS, toTimespec(&timeout, timeoutMs));
+    int n = kevent(d_efd, 0, 0, ev, MAX_KQUEUE_EVENTS, toTimespec(&timeout, timeoutNs));
     if (n < 0)
         return n;
 
@@ -77,7 +95,7 @@ int Poller::wait(int timeoutMs)
         static_cast<FilePoll*>(kev.udata)->handleEvents(flags);
     }
 
-    return 0;
+    return n;
 }
 
 }
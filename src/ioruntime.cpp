@@ -0,0 +1,369 @@
+#include "ioruntime.h"
+
+#include <assert.h>
+
+namespace iocoro
+{
+
+struct Runtime::Task
+{
+    std::function<void()> fn;
+};
+
+namespace {
+
+//////////////////////////////////////////////////////////////////////////
+// class TaskDeque
+//////////////////////////////////////////////////////////////////////////
+
+// Chase-Lev work-stealing deque (Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models"). Owner pushes and pops at the
+// bottom, other threads steal from the top.
+class TaskDeque
+{
+    typedef Runtime::Task Task;
+
+    struct Array
+    {
+        explicit Array(std::size_t n) : mask(n - 1), items(n) {}
+
+        std::size_t capacity() const { return mask + 1; }
+        Task* get(int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, Task* t) { items[i & mask].store(t, std::memory_order_relaxed); }
+
+        std::size_t mask;
+        std::vector<std::atomic<Task*>> items;
+    };
+
+    std::atomic<int64_t> d_top{0};
+    std::atomic<int64_t> d_bottom{0};
+    std::atomic<Array*> d_array;
+    // retired arrays may still be read by thieves, keep them until the end
+    std::vector<std::unique_ptr<Array>> d_arrays;
+
+    Array* grow(Array* a, int64_t top, int64_t bottom)
+    {
+        d_arrays.emplace_back(new Array(a->capacity() * 2));
+        Array* na = d_arrays.back().get();
+        for (int64_t i = top; i != bottom; ++i) {
+            na->put(i, a->get(i));
+        }
+        d_array.store(na, std::memory_order_release);
+        return na;
+    }
+
+public:
+    TaskDeque()
+    {
+        d_arrays.emplace_back(new Array(256));
+        d_array.store(d_arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    // owner only
+    void push(Task* t)
+    {
+        int64_t b = d_bottom.load(std::memory_order_relaxed);
+        int64_t top = d_top.load(std::memory_order_acquire);
+        Array* a = d_array.load(std::memory_order_relaxed);
+
+        if (b - top > static_cast<int64_t>(a->capacity()) - 1) {
+            a = grow(a, top, b);
+        }
+
+        a->put(b, t);
+        std::atomic_thread_fence(std::memory_order_release);
+        d_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // owner only
+    Task* pop()
+    {
+        int64_t b = d_bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = d_array.load(std::memory_order_relaxed);
+        d_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = d_top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            // empty
+            d_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        Task* task = a->get(b);
+        if (t == b) {
+            // last element, race against thieves
+            if (!d_top.compare_exchange_strong(t, t + 1,
+                        std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                task = nullptr;
+            }
+            d_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        return task;
+    }
+
+    // any thread
+    Task* steal()
+    {
+        int64_t t = d_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = d_bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+            return nullptr;
+
+        Array* a = d_array.load(std::memory_order_acquire);
+        Task* task = a->get(t);
+        if (!d_top.compare_exchange_strong(t, t + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            // lost the race to another thief or the owner
+            return nullptr;
+        }
+
+        return task;
+    }
+
+    bool empty() const
+    {
+        return d_top.load(std::memory_order_relaxed)
+            >= d_bottom.load(std::memory_order_relaxed);
+    }
+};
+
+thread_local Runtime::Worker* tls_worker = nullptr;
+
+} // end anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////
+// struct Worker
+//////////////////////////////////////////////////////////////////////////
+struct Runtime::Worker
+{
+    Worker(Runtime& rt, std::size_t i)
+        : runtime(rt), index(i), seed(static_cast<uint32_t>(i) * 2654435761u + 1) {}
+
+    Runtime& runtime;
+    std::size_t index;
+    uint32_t seed;
+    TaskDeque tasks;
+    WakeupFd wakeup;
+    std::atomic<bool> parked{false};
+    Context* feeder{nullptr};
+
+    uint32_t random()
+    {
+        // xorshift32
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+
+    Task* next()
+    {
+        Task* t = tasks.pop();
+        if (t == nullptr)
+            t = runtime.popInjected();
+        if (t == nullptr)
+            t = runtime.stealTask(*this);
+        return t;
+    }
+
+    void run(Dispatcher& d, Task* t)
+    {
+        Runtime* rt = &runtime;
+        d.spawn([rt, t] {
+            t->fn();
+            delete t;
+            rt->taskDone();
+        });
+    }
+
+    // Feeder coroutine: moves tasks into the dispatcher one at a time,
+    // so that the rest of the queue stays available for stealing
+    void feed(Dispatcher& d)
+    {
+        ContextPoll poll(wakeup.handle());
+        feeder = Context::self();
+
+        for (;;) {
+            Task* t = next();
+            if (t != nullptr) {
+                run(d, t);
+                continue;
+            }
+
+            if (runtime.d_stopping.load() && runtime.d_pending.load() == 0)
+                break;
+
+            // announce we are idle, then check again to not miss a wakeup
+            parked.store(true);
+            runtime.d_parked.fetch_add(1);
+
+            t = next();
+            if (t == nullptr && !(runtime.d_stopping.load() && runtime.d_pending.load() == 0)) {
+                while (parked.load()) {
+                    if (wakeup.drain())
+                        break;
+                    poll.waitRead();
+                }
+            }
+
+            if (parked.exchange(false)) {
+                runtime.d_parked.fetch_sub(1);
+            }
+
+            if (t != nullptr) {
+                run(d, t);
+            }
+        }
+
+        feeder = nullptr;
+    }
+
+    void main()
+    {
+        tls_worker = this;
+
+        Dispatcher d(runtime.d_stackPolicy);
+        d.spawn([this, &d] { feed(d); });
+        d.dispatch();
+
+        tls_worker = nullptr;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// class Runtime
+//////////////////////////////////////////////////////////////////////////
+Runtime::Runtime(std::size_t threads, const StackPolicy& stackPolicy)
+: d_stackPolicy(stackPolicy)
+{
+    if (threads == 0)
+        threads = 1;
+
+    for (std::size_t i = 0; i < threads; ++i) {
+        d_workers.emplace_back(new Worker(*this, i));
+    }
+
+    for (auto& w : d_workers) {
+        Worker* worker = w.get();
+        d_threads.emplace_back([worker] { worker->main(); });
+    }
+}
+
+Runtime::~Runtime()
+{
+    join();
+}
+
+Runtime* Runtime::current()
+{
+    return tls_worker ? &tls_worker->runtime : nullptr;
+}
+
+void Runtime::spawn(std::function<void()>&& f)
+{
+    Task* t = new Task{std::move(f)};
+    d_pending.fetch_add(1);
+
+    Worker* w = tls_worker;
+    if (w != nullptr && &w->runtime == this) {
+        w->tasks.push(t);
+
+        // feeder of this worker may be parked waiting for work,
+        // it runs on this thread, so no syscall is needed to wake it
+        if (w->parked.exchange(false)) {
+            d_parked.fetch_sub(1);
+            w->feeder->enable();
+        }
+    } else {
+        std::lock_guard<std::mutex> lock(d_injectedLock);
+        d_injected.push_back(t);
+        d_injectedCount.fetch_add(1);
+    }
+
+    // let idle workers steal
+    if (d_parked.load() != 0) {
+        wakeOne();
+    }
+}
+
+void Runtime::join()
+{
+    if (d_threads.empty())
+        return;
+
+    d_stopping.store(true);
+    wakeAll();
+
+    for (auto& t : d_threads) {
+        t.join();
+    }
+
+    d_threads.clear();
+}
+
+Runtime::Task* Runtime::popInjected()
+{
+    if (d_injectedCount.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(d_injectedLock);
+    if (d_injected.empty())
+        return nullptr;
+
+    Task* t = d_injected.front();
+    d_injected.pop_front();
+    d_injectedCount.fetch_sub(1);
+    return t;
+}
+
+Runtime::Task* Runtime::stealTask(Worker& thief)
+{
+    const std::size_t n = d_workers.size();
+    std::size_t start = thief.random() % n;
+
+    for (std::size_t i = 0; i < n; ++i) {
+        Worker& victim = *d_workers[(start + i) % n];
+        if (&victim == &thief || victim.tasks.empty())
+            continue;
+
+        if (Task* t = victim.tasks.steal())
+            return t;
+    }
+
+    return nullptr;
+}
+
+void Runtime::taskDone()
+{
+    if (d_pending.fetch_sub(1) == 1 && d_stopping.load()) {
+        // last task finished, let parked workers exit
+        wakeAll();
+    }
+}
+
+void Runtime::wakeOne()
+{
+    for (auto& w : d_workers) {
+        if (w->parked.exchange(false)) {
+            d_parked.fetch_sub(1);
+            w->wakeup.signal();
+            return;
+        }
+    }
+}
+
+void Runtime::wakeAll()
+{
+    for (auto& w : d_workers) {
+        if (w->parked.exchange(false)) {
+            d_parked.fetch_sub(1);
+        }
+        w->wakeup.signal();
+    }
+}
+
+}
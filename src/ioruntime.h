@@ -0,0 +1,70 @@
+#pragma once
+
+#include "iocoro.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace iocoro
+{
+
+// Multi-threaded runtime: every worker thread runs its own Dispatcher
+// and Poller. Spawned tasks are queued on per-worker lock-free deques
+// and idle workers steal tasks from busy ones.
+//
+// Only tasks that have not started are stolen, Contexts are never
+// migrated. A Context keeps its worker for life: its stack, buffers,
+// io_uring operations and the poller registrations of its fds belong to
+// that worker's Dispatcher. Balancing therefore happens at spawn time,
+// e.g. a server spreads its connections by accepting in one task and
+// handing every fd to a new task through spawn(). The fd is registered
+// in the poller of the worker the task ends up on.
+class Runtime
+{
+public:
+    struct Task;
+    struct Worker;
+
+    explicit Runtime(std::size_t threads = std::thread::hardware_concurrency(),
+            const StackPolicy& stackPolicy = StackPolicy());
+    // waits for all tasks to finish
+    ~Runtime();
+
+    // can be called from any thread, including runtime's coroutines
+    void spawn(std::function<void()>&& f);
+    // waits until all spawned tasks (and tasks spawned by them) finish,
+    // then stops worker threads
+    void join();
+
+    std::size_t size() const { return d_workers.size(); }
+
+    // runtime owning the calling thread, nullptr if not a worker thread
+    static Runtime* current();
+
+private:
+    friend struct Worker;
+
+    StackPolicy d_stackPolicy;
+    std::vector<std::unique_ptr<Worker>> d_workers;
+    std::vector<std::thread> d_threads;
+
+    // tasks submitted from outside of worker threads
+    std::mutex d_injectedLock;
+    std::deque<Task*> d_injected;
+    std::atomic<std::size_t> d_injectedCount{0};
+
+    std::atomic<std::size_t> d_pending{0};  // spawned but not finished
+    std::atomic<std::size_t> d_parked{0};   // workers waiting for work
+    std::atomic<bool> d_stopping{false};
+
+    Task* popInjected();
+    Task* stealTask(Worker& thief);
+    void taskDone();
+    void wakeOne();
+    void wakeAll();
+};
+
+}
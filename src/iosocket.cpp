@@ -1,19 +1,70 @@
 #include "iosocket.h"
+#include "iouring.h"
 
+#include <assert.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <limits.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#endif
+
+#include <algorithm>
+#include <memory>
+#include <vector>
 
 
 namespace iocoro {
 
+static_assert(sizeof(IoVec) == sizeof(iovec) 
+        && offsetof(IoVec, data) == offsetof(iovec, iov_base)
+        && offsetof(IoVec, len) == offsetof(iovec, iov_len),
+        "IoVec must be layout compatible with iovec");
+
 namespace {
 
+#ifdef IOV_MAX
+const std::size_t MAX_IOVECS = IOV_MAX;
+#else
+const std::size_t MAX_IOVECS = 1024;
+#endif
+
+iovec* toIovec(IoVec* buf)
+{
+    return reinterpret_cast<iovec*>(buf);
+}
+
+// skips fully transferred buffers and adjusts partially transferred one,
+// returns new count
+std::size_t advance(IoVec*& buf, std::size_t count, std::size_t done)
+{
+    while (count > 0 && done >= buf->len) {
+        done -= buf->len;
+        ++buf;
+        --count;
+    }
+
+    if (done > 0) {
+        buf->data += done;
+        buf->len -= done;
+    }
+
+    return count;
+}
+
 sockaddr_in toSockAddr(const IP4Endpoint& endpoint)
 {
     sockaddr_in addr;
@@ -30,6 +81,50 @@ IP4Endpoint toIP4Endpoint(const sockaddr_in& addr)
             ntohs(addr.sin_port));
 }
 
+#ifdef IOCORO_WITH_URING
+
+// Runs operation queued by prep and converts result to -1/errno.
+// Older kernels report EAGAIN for non-blocking sockets instead of
+// arming internal poll, wait for readiness and retry then.
+template <class Prep>
+int ringCall(IoUring& ring, int fd, uint32_t pollEvents, Prep prep,
+        Clock::time_point deadline = Clock::time_point::max())
+{
+    for (;;) {
+        IoUring::Op op;
+        prep(op);
+        int r = ring.wait(op, deadline);
+
+        if (r == -EAGAIN) {
+            IoUring::Op poll;
+            ring.pollAdd(poll, fd, pollEvents);
+            r = ring.wait(poll, deadline);
+            if (r >= 0)
+                continue;
+        }
+
+        if (r < 0) {
+            errno = -r;
+            return -1;
+        }
+
+        return r;
+    }
+}
+
+#endif
+
+// result of a ContextPoll wait, false with errno set on timeout or interrupt
+bool waited(int r)
+{
+    if (r != 0) {
+        errno = r;
+        return false;
+    }
+    return true;
+}
+
+#ifndef SOCK_NONBLOCK
 int make_socket_non_blocking (int sfd) 
 {
     int flags, s;
@@ -51,6 +146,225 @@ int make_socket_non_blocking (int sfd)
 
     return 0;
 }
+#endif
+
+// creates non-blocking close-on-exec socket, throws on failure
+int createSocket(int domain, int type)
+{
+#ifdef SOCK_NONBLOCK
+    int sfd = socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sfd == -1)
+        throw std::runtime_error("Failed to create socket");
+#else
+    int sfd = socket(domain, type, 0);
+    if (sfd == -1)
+        throw std::runtime_error("Failed to create socket");
+    make_socket_non_blocking(sfd);
+    fcntl(sfd, F_SETFD, FD_CLOEXEC);
+#endif
+    return sfd;
+}
+
+// Accepted socket is non-blocking and close-on-exec.
+// Returns -1 with errno set on failure, EAGAIN if backlog is empty.
+int acceptSocket(int lfd, sockaddr_storage& addr, socklen_t& len)
+{
+    len = sizeof(addr);
+
+#ifdef SOCK_NONBLOCK
+    return ::accept4(lfd, (sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int fd = ::accept(lfd, (sockaddr*)&addr, &len);
+    if (fd >= 0) {
+        make_socket_non_blocking(fd);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        // accepted sockets inherit TCP_NODELAY from listener on Linux only
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
+    }
+    return fd;
+#endif
+}
+
+// returns size sent, -1 with errno set, EAGAIN if nothing was sent
+ssize_t sendFileChunk(int sock, int fd, uint64_t offset, std::size_t len)
+{
+#ifdef __APPLE__
+    off_t sent = len;
+    int r = ::sendfile(fd, sock, offset, &sent, nullptr, 0);
+    // partial progress is reported together with EAGAIN
+    if (r < 0 && !(errno == EAGAIN && sent > 0))
+        return -1;
+    return sent;
+#else
+    off_t off = offset;
+    return ::sendfile(sock, fd, &off, len);
+#endif
+}
+
+#ifdef __linux__
+
+// Pipes used by spliceTo(), cached per thread. A pipe only returns
+// to the pool when it is empty.
+class PipePool
+{
+public:
+    struct Pipe
+    {
+        FileHandle read;
+        FileHandle write;
+    };
+
+    bool acquire(Pipe& p)
+    {
+        if (!d_pipes.empty()) {
+            p = std::move(d_pipes.back());
+            d_pipes.pop_back();
+            return true;
+        }
+
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0)
+            return false;
+
+        p.read = FileHandle(fds[0]);
+        p.write = FileHandle(fds[1]);
+        return true;
+    }
+
+    void release(Pipe&& p)
+    {
+        if (d_pipes.size() < MAX_CACHED)
+            d_pipes.push_back(std::move(p));
+    }
+
+    static PipePool& local()
+    {
+        static thread_local PipePool pool;
+        return pool;
+    }
+
+private:
+    static const std::size_t MAX_CACHED = 16;
+    std::vector<Pipe> d_pipes;
+};
+
+#endif
+
+// control buffer for the UDP_GRO segment size
+union GroControl
+{
+    char buf[CMSG_SPACE(sizeof(int))];
+    cmsghdr align;
+};
+
+void setDatagram(Datagram& d, const msghdr& hdr, std::size_t size)
+{
+    d.size = size;
+    d.endpoint = toIP4Endpoint(*static_cast<const sockaddr_in*>(hdr.msg_name));
+    d.segmentSize = 0;
+
+#ifdef UDP_GRO
+    if (hdr.msg_controllen == 0)
+        return;
+
+    msghdr& h = const_cast<msghdr&>(hdr);
+    for (cmsghdr* c = CMSG_FIRSTHDR(&h); c != nullptr; c = CMSG_NXTHDR(&h, c)) {
+        if (c->cmsg_level == IPPROTO_UDP && c->cmsg_type == UDP_GRO) {
+            int segment;
+            memcpy(&segment, CMSG_DATA(c), sizeof(segment));
+            d.segmentSize = segment;
+        }
+    }
+#endif
+}
+
+void prepareHeader(msghdr& hdr, sockaddr_in* addr, IoVec* buf, GroControl* control)
+{
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = addr;
+    hdr.msg_namelen = addr ? sizeof(*addr) : 0;
+    hdr.msg_iov = toIovec(buf);
+    hdr.msg_iovlen = 1;
+    if (control) {
+        hdr.msg_control = control->buf;
+        hdr.msg_controllen = sizeof(control->buf);
+    }
+}
+
+// Receives up to count datagrams (at most MAX_BATCH) without waiting,
+// returns number received or -1 with errno set, EAGAIN if none queued.
+int recvBatch(int fd, Datagram* msgs, std::size_t count, bool offload)
+{
+    const std::size_t MAX_BATCH = DatagramSocket::MAX_BATCH;
+    count = std::min(count, MAX_BATCH);
+
+    sockaddr_in addrs[MAX_BATCH];
+    GroControl control[MAX_BATCH];
+
+#ifdef __linux__
+    mmsghdr hdrs[MAX_BATCH];
+    for (std::size_t i = 0; i < count; ++i) {
+        prepareHeader(hdrs[i].msg_hdr, &addrs[i], &msgs[i].buf, offload ? &control[i] : nullptr);
+    }
+
+    int n = ::recvmmsg(fd, hdrs, count, 0, nullptr);
+    for (int i = 0; i < n; ++i) {
+        setDatagram(msgs[i], hdrs[i].msg_hdr, hdrs[i].msg_len);
+    }
+    return n;
+#else
+    for (std::size_t i = 0; i < count; ++i) {
+        msghdr hdr;
+        prepareHeader(hdr, &addrs[i], &msgs[i].buf, offload ? &control[i] : nullptr);
+
+        ssize_t r = ::recvmsg(fd, &hdr, 0);
+        if (r < 0)
+            return i > 0 ? i : -1;
+        setDatagram(msgs[i], hdr, r);
+    }
+    return count;
+#endif
+}
+
+// Sends up to count datagrams (at most MAX_BATCH), returns number sent
+// or -1 with errno set.
+int sendBatch(int fd, const Datagram* msgs, std::size_t count)
+{
+    const std::size_t MAX_BATCH = DatagramSocket::MAX_BATCH;
+    count = std::min(count, MAX_BATCH);
+
+    sockaddr_in addrs[MAX_BATCH];
+
+#ifdef __linux__
+    mmsghdr hdrs[MAX_BATCH];
+    for (std::size_t i = 0; i < count; ++i) {
+        sockaddr_in* addr = nullptr;
+        if (msgs[i].endpoint.port != 0) {
+            addrs[i] = toSockAddr(msgs[i].endpoint);
+            addr = &addrs[i];
+        }
+        prepareHeader(hdrs[i].msg_hdr, addr, const_cast<IoVec*>(&msgs[i].buf), nullptr);
+    }
+
+    return ::sendmmsg(fd, hdrs, count, 0);
+#else
+    for (std::size_t i = 0; i < count; ++i) {
+        sockaddr_in* addr = nullptr;
+        if (msgs[i].endpoint.port != 0) {
+            addrs[i] = toSockAddr(msgs[i].endpoint);
+            addr = &addrs[i];
+        }
+
+        msghdr hdr;
+        prepareHeader(hdr, addr, const_cast<IoVec*>(&msgs[i].buf), nullptr);
+        if (::sendmsg(fd, &hdr, 0) < 0)
+            return i > 0 ? i : -1;
+    }
+    return count;
+#endif
+}
 
 } // end anonymous namespace
 
@@ -71,40 +385,266 @@ IP4Address IP4Address::loopback()
     return IP4Address(INADDR_LOOPBACK);
 }
 
+//////////////////////////////////////////////////////////////////////////
+// class Endpoint
+//////////////////////////////////////////////////////////////////////////
+Endpoint::Endpoint()
+{
+    memset(&d_addr, 0, sizeof(d_addr));
+    d_addr.sa.sa_family = AF_UNSPEC;
+}
+
+Endpoint::Endpoint(const IP4Endpoint& ep)
+: Endpoint()
+{
+    d_addr.in4 = toSockAddr(ep);
+    d_len = sizeof(d_addr.in4);
+}
+
+Endpoint::Endpoint(const sockaddr* addr, socklen_t len)
+: Endpoint()
+{
+    d_len = std::min<socklen_t>(len, sizeof(d_addr));
+    memcpy(&d_addr, addr, d_len);
+}
+
+Endpoint Endpoint::ip6(const char* addr, uint16_t port)
+{
+    Endpoint ep;
+    if (inet_pton(AF_INET6, addr, &ep.d_addr.in6.sin6_addr) != 1)
+        return Endpoint();
+
+    ep.d_addr.in6.sin6_family = AF_INET6;
+    ep.d_addr.in6.sin6_port = htons(port);
+    ep.d_len = sizeof(ep.d_addr.in6);
+    return ep;
+}
+
+Endpoint Endpoint::local(const std::string& path)
+{
+    Endpoint ep;
+    // regular paths need room for the terminating zero
+    bool abstract = !path.empty() && path[0] == '\0';
+    if (path.size() + (abstract ? 0 : 1) > sizeof(ep.d_addr.un.sun_path))
+        return Endpoint();
+
+    ep.d_addr.un.sun_family = AF_UNIX;
+    memcpy(ep.d_addr.un.sun_path, path.data(), path.size());
+    ep.d_len = offsetof(sockaddr_un, sun_path) + path.size() + (abstract ? 0 : 1);
+    return ep;
+}
+
+uint16_t Endpoint::port() const
+{
+    switch (family()) {
+    case AF_INET:
+        return ntohs(d_addr.in4.sin_port);
+    case AF_INET6:
+        return ntohs(d_addr.in6.sin6_port);
+    default:
+        return 0;
+    }
+}
+
+IP4Endpoint Endpoint::ip4() const
+{
+    if (family() != AF_INET)
+        return IP4Endpoint();
+    return toIP4Endpoint(d_addr.in4);
+}
+
+std::string Endpoint::path() const
+{
+    const std::size_t offset = offsetof(sockaddr_un, sun_path);
+    if (family() != AF_UNIX || d_len <= offset)
+        return std::string();
+
+    std::size_t len = d_len - offset;
+    // drop the terminating zero of regular paths
+    if (d_addr.un.sun_path[0] != '\0')
+        len = strnlen(d_addr.un.sun_path, len);
+    return std::string(d_addr.un.sun_path, len);
+}
+
+bool operator == (const Endpoint& a, const Endpoint& b)
+{
+    if (a.family() != b.family())
+        return false;
+
+    switch (a.family()) {
+    case AF_INET:
+        return a.d_addr.in4.sin_port == b.d_addr.in4.sin_port
+            && a.d_addr.in4.sin_addr.s_addr == b.d_addr.in4.sin_addr.s_addr;
+    case AF_INET6:
+        return a.d_addr.in6.sin6_port == b.d_addr.in6.sin6_port
+            && memcmp(&a.d_addr.in6.sin6_addr, &b.d_addr.in6.sin6_addr, sizeof(in6_addr)) == 0;
+    case AF_UNIX:
+        return a.path() == b.path();
+    default:
+        return true;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////
 // class Connection 
 //////////////////////////////////////////////////////////////////////////
+
+// Holds the connection for one writeAll(), later writers wait in FIFO
+// order.
+class Connection::WriteGuard
+{
+    Connection& d_conn;
+    bool d_owned{false};
+
+public:
+    explicit WriteGuard(Connection& conn) : d_conn(conn) {}
+
+    ~WriteGuard()
+    {
+        if (!d_owned)
+            return;
+
+        // handed over without clearing d_writing
+        if (Context* next = d_conn.d_writers.dequeue()) {
+            next->enable();
+            return;
+        }
+
+        d_conn.d_writing = false;
+        if (!d_conn.d_corkBuffer.empty())
+            Context::self()->dispatcher().scheduleFlush(d_conn);
+    }
+
+    // returns false with errno ETIMEDOUT or ECANCELED if deadline
+    // passes or the context is interrupted first
+    bool acquire(Clock::time_point deadline)
+    {
+        if (!d_conn.d_writing) {
+            d_conn.d_writing = true;
+        } else if (!d_conn.d_writers.wait(deadline)) {
+            return false;
+        }
+
+        d_owned = true;
+        return true;
+    }
+};
+
 Connection::Connection(int fd) 
 {
     attach(fd);
 }
 
+Connection::~Connection()
+{
+    // nothing may be left for the dispatcher once the socket is closed
+    if (!d_corkBuffer.empty() && Context::self() != nullptr)
+        flush();
+
+#ifdef IOCORO_WITH_URING
+    // registered file keeps the socket open, so closing it would not
+    // drop it from the poller
+    if (IoUring* ring = IoUring::current()) {
+        d_poll.remove();
+        ring->unregisterFile(d_handle);
+    }
+#endif
+    releasePoll();
+}
+
+void Connection::setHandle(FileHandle&& handle)
+{
+#ifdef IOCORO_WITH_URING
+    // registered files keep the socket open until unregistered
+    if (IoUring* ring = IoUring::current()) {
+        d_poll.remove();
+        ring->unregisterFile(d_handle);
+        ring->registerFile(handle);
+    }
+#endif
+    releasePoll();
+    d_handle = std::move(handle);
+    d_ownsSocket = false;
+
+    // zero-copy is a per socket option
+    d_zeroCopyThreshold = 0;
+    d_zeroCopySent = 0;
+    d_zeroCopyReleased = 0;
+
+    d_corkBuffer.clear();
+    d_corkError = 0;
+    Flushable::unlink();
+}
+
 void Connection::attach(int fd)
 {
-    d_handle = FileHandle(fd);
+    setHandle(FileHandle(fd));
     d_poll.add(fd);
+    d_remoteAddr = Endpoint();
+}
+
+void Connection::adopt(int fd)
+{
+    attach(fd);
+    d_ownsSocket = true;
+}
+
+void Connection::releasePoll()
+{
+    // closing the socket removes it from the poller only if no other
+    // descriptor refers to it, so a caller's or passed on fd is removed
+    if (d_ownsSocket)
+        d_poll.release();
+    else
+        d_poll.remove();
+}
+
+Endpoint Connection::remoteAddress() const
+{
+    if (d_remoteAddr.family() != AF_UNSPEC || d_handle == -1)
+        return d_remoteAddr;
+
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getpeername(d_handle, (sockaddr*)&addr, &len) != 0)
+        return Endpoint();
+    return Endpoint((sockaddr*)&addr, len);
 }
 
-int Connection::connect(const IP4Endpoint& endpoint)
+int Connection::connect(const Endpoint& endpoint, Clock::time_point deadline)
 {
     FileHandle fd;
 
-    int sfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sfd == -1)
-        throw std::runtime_error("Failed to create socket");
-    make_socket_non_blocking(sfd);
+    if (endpoint.family() == AF_UNSPEC)
+        return EAFNOSUPPORT;
 
+    int sfd = createSocket(endpoint.family(), SOCK_STREAM);
     fd = sfd;
     ContextPoll poll(sfd);
 
-    sockaddr_in serv_addr = toSockAddr(endpoint);
+#ifdef IOCORO_WITH_URING
+    if (IoUring* ring = IoUring::current()) {
+        int r = ringCall(*ring, sfd, POLLOUT, [&](IoUring::Op& op) {
+            ring->connect(op, sfd, endpoint.sockAddr(), endpoint.size());
+        }, deadline);
+        if (r < 0)
+            return errno;
+
+        d_remoteAddr = endpoint;
+        setHandle(std::move(fd));
+        d_poll = std::move(poll);
+        d_ownsSocket = true;
+        return 0;
+    }
+#endif
 
-    int r = ::connect(sfd, (sockaddr*)&serv_addr, sizeof(serv_addr));
+    int r = ::connect(sfd, endpoint.sockAddr(), endpoint.size());
 
     if (r < 0) {
         if (errno != EINPROGRESS)
             return errno;
-        poll.waitWrite();
+        if (int e = poll.waitWrite(deadline))
+            return e;
     } 
 
     int result;
@@ -120,19 +660,29 @@ int Connection::connect(const IP4Endpoint& endpoint)
     }
 
     d_remoteAddr = endpoint;
-    d_handle = std::move(fd);
+    setHandle(std::move(fd));
     d_poll = std::move(poll);
+    d_ownsSocket = true;
     return result;
 }
 
-int Connection::read(char* buf, std::size_t sz)
+int Connection::read(char* buf, std::size_t sz, Clock::time_point deadline)
 {
+#ifdef IOCORO_WITH_URING
+    if (IoUring* ring = IoUring::current()) {
+        return ringCall(*ring, d_handle, POLLIN, [&](IoUring::Op& op) {
+            ring->recv(op, d_handle, buf, sz, 0);
+        }, deadline);
+    }
+#endif
+
     for (;;) {
         int r = ::recv(d_handle, buf, sz, 0);
 
         if (r < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                d_poll.waitRead();
+                if (!waited(d_poll.waitRead(deadline)))
+                    return -1;
             } else {
                 return r;
             }
@@ -142,98 +692,1021 @@ int Connection::read(char* buf, std::size_t sz)
     }
 }
 
-int Connection::writeAll(const char* buf, std::size_t sz)
+int Connection::readv(IoVec* buf, std::size_t count, Clock::time_point deadline)
 {
-    std::size_t szLeft = sz; 
+#ifdef IOCORO_WITH_URING
+    if (IoUring* ring = IoUring::current()) {
+        return ringCall(*ring, d_handle, POLLIN, [&](IoUring::Op& op) {
+            ring->readv(op, d_handle, toIovec(buf), std::min(count, MAX_IOVECS), 0);
+        }, deadline);
+    }
+#endif
+
     for (;;) {
-        int r = ::write(d_handle, buf, szLeft);
+        int r = ::readv(d_handle, toIovec(buf), std::min(count, MAX_IOVECS));
 
         if (r < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                d_poll.waitWrite();
+                if (!waited(d_poll.waitRead(deadline)))
+                    return -1;
             } else {
                 return r;
             }
         } else {
-            buf += r;
-            szLeft -= r;
-            if (szLeft == 0)
-                return r;
+            return r;
         }
     }
 }
 
-void Connection::shutdown()
-{
-    ::shutdown(d_handle, SHUT_RDWR);
-}
-
-//////////////////////////////////////////////////////////////////////////
-// class Listener
-//////////////////////////////////////////////////////////////////////////
-Listener::Listener()
+int Connection::readAll(IoVec* buf, std::size_t count, Clock::time_point deadline)
 {
-    int sfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sfd == -1)
-        throw std::runtime_error("Failed to create socket");
+    int total = 0;
+    count = advance(buf, count, 0);
 
-    int enable = 1;
-    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
-    setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int));
+    while (count > 0) {
+        int r = readv(buf, count, deadline);
+        if (r <= 0)
+            return r;
 
-    make_socket_non_blocking(sfd);
+        total += r;
+        count = advance(buf, count, r);
+    }
 
-    d_handle = FileHandle(sfd);
+    return total;
 }
 
-int Listener::bind(const IP4Endpoint& endpoint)
+int Connection::writeAll(const char* buf, std::size_t sz, Clock::time_point deadline)
 {
-    auto serv_addr = toSockAddr(endpoint);
-    int retval = ::bind(d_handle, (struct sockaddr *) &serv_addr, sizeof(serv_addr));
-    if (retval != 0) {
-        fprintf(stderr, "Could not bind\n");
-        return errno;
-    }
+    std::size_t szLeft = sz; 
 
-    return retval;
-}
+    if (d_corked) {
+        // flush() reports the error of a previous flush
+        if ((d_corkError != 0 || d_corkBuffer.size() + sz > CORK_LIMIT) && flush(deadline) < 0)
+            return -1;
+        if (sz <= CORK_LIMIT)
+            return cork(buf, sz);
+    }
 
-int Listener::listen(int backlog)
-{
-    int r = ::listen(d_handle.handle(), backlog);
+    WriteGuard guard(*this);
+    if (!guard.acquire(deadline))
+        return -1;
 
-    if (r != 0) {
-        return errno;
+    if (d_zeroCopyThreshold != 0 && sz >= d_zeroCopyThreshold) {
+        if (sendZeroCopyLocked(buf, sz, deadline) < 0 || waitZeroCopy(deadline) < 0)
+            return -1;
+        return sz;
     }
 
-    d_poll.add(d_handle);
-    return r;
-}
+#ifdef IOCORO_WITH_URING
+    if (IoUring* ring = IoUring::current()) {
+        while (szLeft > 0) {
+            int r = ringCall(*ring, d_handle, POLLOUT, [&](IoUring::Op& op) {
+                ring->send(op, d_handle, buf, szLeft, 0);
+            }, deadline);
+            if (r < 0)
+                return r;
 
-bool Listener::accept(Connection& conn)
-{
-    sockaddr_in inAddr;
-    socklen_t inLen = sizeof(inAddr);
+            buf += r;
+            szLeft -= r;
+        }
+        return sz;
+    }
+#endif
 
     for (;;) {
-        int infd = ::accept(d_handle.handle(), (sockaddr*)&inAddr, &inLen);
-        if (infd < 0) {
-            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                fprintf(stderr, "accept4 failed: %d\n", errno);
-                return false;
+        int r = ::write(d_handle, buf, szLeft);
+
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (!waited(d_poll.waitWrite(deadline)))
+                    return -1;
+            } else {
+                return r;
             }
-            d_poll.waitRead();
         } else {
-            make_socket_non_blocking(infd);
-
-            int enable = 1;
-            setsockopt(infd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
-            conn.attach(infd);
-            conn.setRemoteAddress(toIP4Endpoint(inAddr));
-            return true;
+            buf += r;
+            szLeft -= r;
+            if (szLeft == 0)
+                return sz;
         }
     }
 }
 
+int Connection::writeAll(IoVec* buf, std::size_t count, Clock::time_point deadline)
+{
+    if (d_corked) {
+        std::size_t sz = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            sz += buf[i].len;
+        }
+
+        if ((d_corkError != 0 || d_corkBuffer.size() + sz > CORK_LIMIT) && flush(deadline) < 0)
+            return -1;
+        if (sz <= CORK_LIMIT) {
+            for (std::size_t i = 0; i < count; ++i) {
+                cork(buf[i].data, buf[i].len);
+            }
+            return sz;
+        }
+    }
+
+    WriteGuard guard(*this);
+    if (!guard.acquire(deadline))
+        return -1;
+
+    return writeAllDirect(buf, count, deadline);
 }
 
+int Connection::writeAllDirect(IoVec* buf, std::size_t count, Clock::time_point deadline)
+{
+    int total = 0;
+    count = advance(buf, count, 0);
+
+#ifdef IOCORO_WITH_URING
+    if (IoUring* ring = IoUring::current()) {
+        while (count > 0) {
+            int r = ringCall(*ring, d_handle, POLLOUT, [&](IoUring::Op& op) {
+                ring->writev(op, d_handle, toIovec(buf), std::min(count, MAX_IOVECS), 0);
+            }, deadline);
+            if (r < 0)
+                return r;
+
+            total += r;
+            count = advance(buf, count, r);
+        }
+        return total;
+    }
+#endif
+
+    while (count > 0) {
+        int r = ::writev(d_handle, toIovec(buf), std::min(count, MAX_IOVECS));
+
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (!waited(d_poll.waitWrite(deadline)))
+                    return -1;
+            } else {
+                return r;
+            }
+        } else {
+            total += r;
+            count = advance(buf, count, r);
+        }
+    }
+
+    return total;
+}
+
+int64_t Connection::sendFile(int fd, uint64_t offset, std::size_t len,
+        Clock::time_point deadline)
+{
+    int64_t total = 0;
+
+    WriteGuard guard(*this);
+    if (!guard.acquire(deadline) || flushLocked(deadline) < 0)
+        return -1;
+
+    while (len > 0) {
+        ssize_t sent = sendFileChunk(d_handle, fd, offset, len);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            if (!waited(d_poll.waitWrite(deadline)))
+                return -1;
+            continue;
+        }
+
+        // end of file
+        if (sent == 0)
+            break;
+
+        offset += sent;
+        len -= sent;
+        total += sent;
+    }
+
+    return total;
+}
+
+int64_t Connection::spliceTo(Connection& dst, std::size_t len, Clock::time_point deadline)
+{
+    WriteGuard guard(dst);
+    if (!guard.acquire(deadline) || dst.flushLocked(deadline) < 0)
+        return -1;
+
+#ifdef __linux__
+    PipePool::Pipe pipe;
+    if (!PipePool::local().acquire(pipe))
+        return -1;
+
+    int64_t total = 0;
+    while (len > 0) {
+        ssize_t in = ::splice(d_handle, nullptr, pipe.write, nullptr, len, 
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in == 0)
+            break;
+
+        if (in < 0) {
+            if (errno != EAGAIN || !waited(d_poll.waitRead(deadline)))
+                return -1;
+            continue;
+        }
+
+        // drain the pipe completely, so it can be reused
+        for (ssize_t left = in; left > 0;) {
+            ssize_t out = ::splice(pipe.read, nullptr, dst.d_handle, nullptr, left, 
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (out < 0) {
+                if (errno != EAGAIN || !waited(dst.d_poll.waitWrite(deadline)))
+                    return -1;
+                continue;
+            }
+            left -= out;
+        }
+
+        len -= in;
+        total += in;
+    }
+
+    PipePool::local().release(std::move(pipe));
+    return total;
+#else
+    char buf[64 * 1024];
+    int64_t total = 0;
+    while (len > 0) {
+        int r = read(buf, std::min(len, sizeof(buf)), deadline);
+        if (r < 0)
+            return -1;
+        if (r == 0)
+            break;
+        IoVec out{buf, static_cast<std::size_t>(r)};
+        if (dst.writeAllDirect(&out, 1, deadline) < 0)
+            return -1;
+        len -= r;
+        total += r;
+    }
+    return total;
+#endif
+}
+
+int Connection::setZeroCopy(bool enable, std::size_t threshold)
+{
+#ifdef SO_ZEROCOPY
+    if (enable) {
+        int one = 1;
+        if (setsockopt(d_handle, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0)
+            return errno;
+    }
+
+    d_zeroCopyThreshold = enable ? std::max<std::size_t>(threshold, 1) : 0;
+    return 0;
+#else
+    return enable ? ENOPROTOOPT : 0;
+#endif
+}
+
+int Connection::sendZeroCopy(const char* buf, std::size_t sz, Clock::time_point deadline)
+{
+    WriteGuard guard(*this);
+    if (!guard.acquire(deadline))
+        return -1;
+
+    return sendZeroCopyLocked(buf, sz, deadline);
+}
+
+int Connection::sendZeroCopyLocked(const char* buf, std::size_t sz, Clock::time_point deadline)
+{
+    if (flushLocked(deadline) < 0)
+        return -1;
+
+#ifdef MSG_ZEROCOPY
+    std::size_t szLeft = sz;
+    int flags = MSG_ZEROCOPY;
+
+    while (szLeft > 0) {
+        ssize_t r = ::send(d_handle, buf, szLeft, flags);
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (!waited(d_poll.waitWrite(deadline)))
+                    return -1;
+            } else if (errno == ENOBUFS && flags != 0) {
+                // out of optmem for pinned pages, copy the rest
+                flags = 0;
+            } else {
+                return -1;
+            }
+            continue;
+        }
+
+        // kernel numbers every successful zero-copy send
+        if (flags != 0)
+            ++d_zeroCopySent;
+
+        buf += r;
+        szLeft -= r;
+    }
+
+    return sz;
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+int Connection::reapZeroCopy()
+{
+#ifdef MSG_ZEROCOPY
+    for (;;) {
+        char control[128];
+        msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (::recvmsg(d_handle, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+            bool recvErr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if (!recvErr)
+                continue;
+
+            auto serr = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            // [ee_info, ee_data] range of released sends, in order for TCP
+            d_zeroCopyReleased = serr->ee_data + 1;
+        }
+    }
+#else
+    return 0;
+#endif
+}
+
+int Connection::waitZeroCopy(Clock::time_point deadline)
+{
+    while (d_zeroCopyReleased != d_zeroCopySent) {
+        if (reapZeroCopy() < 0)
+            return -1;
+
+        if (d_zeroCopyReleased != d_zeroCopySent && !waited(d_poll.waitError(deadline)))
+            return -1;
+    }
+
+    return 0;
+}
+
+int Connection::sendFds(const char* buf, std::size_t sz, const int* fds, std::size_t count,
+        Clock::time_point deadline)
+{
+    if (sz == 0 || count > MAX_PASSED_FDS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    WriteGuard guard(*this);
+    if (!guard.acquire(deadline) || flushLocked(deadline) < 0)
+        return -1;
+
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+        cmsghdr align;
+    } control;
+
+    iovec iov{const_cast<char*>(buf), sz};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (count > 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+        cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(c), fds, sizeof(int) * count);
+
+        // the receiver holds the socket open after we close it
+        if (std::find(fds, fds + count, int(d_handle)) != fds + count)
+            d_ownsSocket = false;
+    }
+
+    for (;;) {
+        ssize_t r = ::sendmsg(d_handle, &msg, 0);
+        if (r < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            if (!waited(d_poll.waitWrite(deadline)))
+                return -1;
+            continue;
+        }
+
+        // descriptors went with the first byte, send the rest as is
+        if (static_cast<std::size_t>(r) < sz) {
+            IoVec rest{const_cast<char*>(buf) + r, sz - r};
+            if (writeAllDirect(&rest, 1, deadline) < 0)
+                return -1;
+        }
+        return sz;
+    }
+}
+
+int Connection::recvFds(char* buf, std::size_t sz, FileHandle* fds, std::size_t max, std::size_t& count,
+        Clock::time_point deadline)
+{
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+        cmsghdr align;
+    } control;
+
+    count = 0;
+    iovec iov{buf, sz};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+#ifdef MSG_CMSG_CLOEXEC
+    const int flags = MSG_CMSG_CLOEXEC;
+#else
+    const int flags = 0;
+#endif
+
+    ssize_t r;
+    while ((r = ::recvmsg(d_handle, &msg, flags)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        if (!waited(d_poll.waitRead(deadline)))
+            return -1;
+    }
+
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        std::size_t n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (std::size_t i = 0; i < n; ++i) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            // closed here if there is no room left in fds
+            FileHandle h(fd);
+            if (count < max) {
+#ifndef MSG_CMSG_CLOEXEC
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+                fds[count++] = std::move(h);
+            }
+        }
+    }
+
+    return r;
+}
+
+void Connection::setCorked(bool corked)
+{
+    if (!corked)
+        flush();
+    d_corked = corked;
+}
+
+int Connection::cork(const char* buf, std::size_t sz)
+{
+    d_corkBuffer.insert(d_corkBuffer.end(), buf, buf + sz);
+    Context::self()->dispatcher().scheduleFlush(*this);
+    return sz;
+}
+
+int Connection::flush(Clock::time_point deadline)
+{
+    if (d_corkError == 0 && d_corkBuffer.empty())
+        return 0;
+
+    WriteGuard guard(*this);
+    if (!guard.acquire(deadline))
+        return -1;
+
+    return flushLocked(deadline);
+}
+
+int Connection::flushLocked(Clock::time_point deadline)
+{
+    if (d_corkError != 0) {
+        errno = d_corkError;
+        d_corkError = 0;
+        return -1;
+    }
+
+    if (d_corkBuffer.empty())
+        return 0;
+
+    // taken out, so the dispatcher does not send it too while we wait
+    std::vector<char> pending;
+    pending.swap(d_corkBuffer);
+    Flushable::unlink();
+
+    IoVec buf{pending.data(), pending.size()};
+    int r = writeAllDirect(&buf, 1, deadline);
+
+    // keep the capacity
+    if (d_corkBuffer.empty()) {
+        pending.clear();
+        d_corkBuffer.swap(pending);
+    }
+
+    return r < 0 ? -1 : 0;
+}
+
+bool Connection::flushPending(Poller& poller)
+{
+    // sent after the data of the current writer, see WriteGuard
+    if (d_writing)
+        return true;
+
+    // plain write even with io_uring, the dispatcher must not wait here
+    std::size_t sent = 0;
+    while (sent < d_corkBuffer.size()) {
+        ssize_t r = ::write(d_handle, d_corkBuffer.data() + sent, d_corkBuffer.size() - sent);
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // writable edge wakes the dispatcher for the rest
+                d_poll.arm(poller);
+                break;
+            }
+
+            d_corkError = errno;
+            sent = d_corkBuffer.size();
+            break;
+        }
+        sent += r;
+    }
+
+    d_corkBuffer.erase(d_corkBuffer.begin(), d_corkBuffer.begin() + sent);
+    return d_corkBuffer.empty();
+}
+
+void Connection::shutdown()
+{
+    flush();
+    ::shutdown(d_handle, SHUT_RDWR);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// class BufferedConnection
+//////////////////////////////////////////////////////////////////////////
+BufferedConnection::BufferedConnection(Connection& conn)
+: d_conn(conn), d_pool(Context::self()->dispatcher().getBufferPool())
+{
+}
+
+BufferedConnection::~BufferedConnection()
+{
+    if (d_readBuf)
+        d_pool.deallocate(d_readBuf);
+    if (d_writeBuf)
+        d_pool.deallocate(d_writeBuf);
+}
+
+int BufferedConnection::fill()
+{
+    const std::size_t capacity = d_pool.bufferSize();
+
+    if (d_readBuf == nullptr) {
+        d_readBuf = d_pool.allocate();
+    } else if (d_readBegin == d_readEnd) {
+        d_readBegin = d_readEnd = 0;
+    } else if (d_readEnd == capacity) {
+        // make room by moving unread data to the front
+        if (d_readBegin == 0)
+            return capacity;
+
+        memmove(d_readBuf, d_readBuf + d_readBegin, d_readEnd - d_readBegin);
+        d_readEnd -= d_readBegin;
+        d_readBegin = 0;
+    }
+
+    int r = d_conn.read(d_readBuf + d_readEnd, capacity - d_readEnd);
+    if (r > 0)
+        d_readEnd += r;
+    return r;
+}
+
+int BufferedConnection::readUntil(char delim, const char*& data)
+{
+    for (;;) {
+        const char* begin = d_readBuf + d_readBegin;
+        std::size_t avail = d_readEnd - d_readBegin;
+
+        if (d_scanned < avail) {
+            auto found = static_cast<const char*>(
+                    memchr(begin + d_scanned, delim, avail - d_scanned));
+            if (found != nullptr) {
+                std::size_t len = found - begin + 1;
+                data = begin;
+                d_readBegin += len;
+                d_scanned = 0;
+                return len;
+            }
+            d_scanned = avail;
+        }
+
+        if (avail == d_pool.bufferSize()) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+
+        int r = fill();
+        if (r <= 0)
+            return r;
+    }
+}
+
+int BufferedConnection::readExactly(char* buf, std::size_t n)
+{
+    std::size_t done = std::min(n, d_readEnd - d_readBegin);
+    if (done > 0) {
+        memcpy(buf, d_readBuf + d_readBegin, done);
+        consume(done);
+    }
+
+    // large remainder goes straight into the caller's buffer
+    while (done < n) {
+        int r = d_conn.read(buf + done, n - done);
+        if (r < 0)
+            return r;
+        if (r == 0)
+            break;
+        done += r;
+    }
+
+    return done;
+}
+
+int BufferedConnection::peek(const char*& data)
+{
+    if (d_readBegin == d_readEnd) {
+        int r = fill();
+        if (r <= 0)
+            return r;
+    }
+
+    data = d_readBuf + d_readBegin;
+    return d_readEnd - d_readBegin;
+}
+
+void BufferedConnection::consume(std::size_t n)
+{
+    assert(n <= d_readEnd - d_readBegin);
+    d_readBegin += n;
+    d_scanned = d_scanned > n ? d_scanned - n : 0;
+}
+
+int BufferedConnection::write(const char* buf, std::size_t sz)
+{
+    const std::size_t capacity = d_pool.bufferSize();
+
+    if (d_writeSize + sz <= capacity) {
+        if (d_writeBuf == nullptr)
+            d_writeBuf = d_pool.allocate();
+
+        memcpy(d_writeBuf + d_writeSize, buf, sz);
+        d_writeSize += sz;
+        return sz;
+    }
+
+    // buffered data and the new chunk go out with one writev
+    IoVec bufs[] = {{d_writeBuf, d_writeSize}, {const_cast<char*>(buf), sz}};
+    if (d_conn.writeAll(bufs, 2) < 0)
+        return -1;
+
+    d_writeSize = 0;
+    return sz;
+}
+
+int BufferedConnection::flush()
+{
+    if (d_writeSize == 0)
+        return 0;
+
+    IoVec buf{d_writeBuf, d_writeSize};
+    if (d_conn.writeAll(&buf, 1) < 0)
+        return -1;
+
+    d_writeSize = 0;
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// class Listener
+//////////////////////////////////////////////////////////////////////////
+Listener::Listener()
+{
+}
+
+int Listener::bind(const Endpoint& endpoint)
+{
+    if (endpoint.family() == AF_UNSPEC)
+        return EAFNOSUPPORT;
+
+    int sfd = createSocket(endpoint.family(), SOCK_STREAM);
+
+    if (endpoint.family() != AF_UNIX) {
+        int enable = 1;
+        setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+        setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int));
+        // inherited by accepted sockets
+        setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
+    }
+
+    d_handle = FileHandle(sfd);
+
+    int retval = ::bind(d_handle, endpoint.sockAddr(), endpoint.size());
+    if (retval != 0) {
+        fprintf(stderr, "Could not bind\n");
+        return errno;
+    }
+
+    return retval;
+}
+
+int Listener::listen(int backlog)
+{
+    int r = ::listen(d_handle.handle(), backlog);
+
+    if (r != 0) {
+        return errno;
+    }
+
+    d_poll.add(d_handle);
+    return r;
+}
+
+void Listener::shutdown()
+{
+    // wakes up pending accept, which fails then
+    ::shutdown(d_handle, SHUT_RDWR);
+}
+
+bool Listener::accept(Connection& conn, Clock::time_point deadline)
+{
+    IncomingConnection in;
+    if (acceptMany(&in, 1, deadline) == 0)
+        return false;
+
+    conn.adopt(in.handle.release());
+    conn.setRemoteAddress(in.endpoint);
+    return true;
+}
+
+std::size_t Listener::acceptMany(IncomingConnection* out, std::size_t max,
+        Clock::time_point deadline)
+{
+    std::size_t count = 0;
+    sockaddr_storage inAddr;
+    socklen_t inLen;
+
+#ifdef IOCORO_WITH_URING
+    if (IoUring* ring = IoUring::current()) {
+        // wait for the first connection through the ring, drain the rest directly
+        int infd = ringCall(*ring, d_handle, POLLIN, [&](IoUring::Op& op) {
+            inLen = sizeof(inAddr);
+            ring->accept(op, d_handle, (sockaddr*)&inAddr, &inLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        }, deadline);
+        if (infd < 0) {
+            if (errno != ETIMEDOUT && errno != ECANCELED)
+                fprintf(stderr, "accept failed: %d\n", errno);
+            return 0;
+        }
+
+        out[count].handle = FileHandle(infd);
+        out[count].endpoint = Endpoint((sockaddr*)&inAddr, inLen);
+        ++count;
+    }
+#endif
+
+    while (count < max) {
+        int infd = acceptSocket(d_handle, inAddr, inLen);
+        if (infd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "accept4 failed: %d\n", errno);
+                break;
+            }
+
+            // backlog is drained
+            if (count > 0 || !waited(d_poll.waitRead(deadline)))
+                break;
+        } else {
+            out[count].handle = FileHandle(infd);
+            out[count].endpoint = Endpoint((sockaddr*)&inAddr, inLen);
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+int Listener::serve(std::function<void(Connection&)>&& handler, std::size_t batch)
+{
+    Context* self = Context::self();
+    assert(self != nullptr);
+    Dispatcher& d = self->dispatcher();
+
+    // shared with handlers that outlive serve()
+    auto h = std::make_shared<std::function<void(Connection&)>>(std::move(handler));
+    std::vector<IncomingConnection> incoming(std::max<std::size_t>(batch, 1));
+
+    for (;;) {
+        std::size_t n = acceptMany(incoming.data(), incoming.size());
+        if (n == 0)
+            return errno;
+
+        for (std::size_t i = 0; i < n; ++i) {
+            // remote address is looked up on demand, so the entry
+            // function stays small enough to be stored inline
+            int fd = incoming[i].handle.release();
+            d.spawnDeferred([h, fd] {
+                Connection conn;
+                conn.adopt(fd);
+                (*h)(conn);
+            });
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// class DatagramSocket
+//////////////////////////////////////////////////////////////////////////
+const std::size_t DatagramSocket::MAX_BATCH;
+
+DatagramSocket::DatagramSocket()
+: d_handle(createSocket(AF_INET, SOCK_DGRAM))
+, d_poll(d_handle)
+{
+}
+
+int DatagramSocket::bind(const IP4Endpoint& endpoint)
+{
+    sockaddr_in addr = toSockAddr(endpoint);
+    if (::bind(d_handle, (sockaddr*)&addr, sizeof(addr)) != 0)
+        return errno;
+    return 0;
+}
+
+int DatagramSocket::connect(const IP4Endpoint& endpoint)
+{
+    sockaddr_in addr = toSockAddr(endpoint);
+    if (::connect(d_handle, (sockaddr*)&addr, sizeof(addr)) != 0)
+        return errno;
+    return 0;
+}
+
+IP4Endpoint DatagramSocket::localEndpoint() const
+{
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(d_handle, (sockaddr*)&addr, &len) != 0)
+        return IP4Endpoint();
+    return toIP4Endpoint(addr);
+}
+
+int DatagramSocket::recvFrom(char* buf, std::size_t sz, IP4Endpoint* from,
+        Clock::time_point deadline)
+{
+    for (;;) {
+        sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int r = ::recvfrom(d_handle, buf, sz, 0, (sockaddr*)&addr, &len);
+
+        if (r >= 0) {
+            if (from)
+                *from = toIP4Endpoint(addr);
+            return r;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        if (!waited(d_poll.waitRead(deadline)))
+            return -1;
+    }
+}
+
+int DatagramSocket::sendTo(const char* buf, std::size_t sz, const IP4Endpoint& to,
+        Clock::time_point deadline)
+{
+    sockaddr_in addr = toSockAddr(to);
+
+    for (;;) {
+        int r = ::sendto(d_handle, buf, sz, 0, (sockaddr*)&addr, sizeof(addr));
+        if (r >= 0)
+            return r;
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        if (!waited(d_poll.waitWrite(deadline)))
+            return -1;
+    }
+}
+
+int DatagramSocket::send(const char* buf, std::size_t sz, Clock::time_point deadline)
+{
+    for (;;) {
+        int r = ::send(d_handle, buf, sz, 0);
+        if (r >= 0)
+            return r;
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        if (!waited(d_poll.waitWrite(deadline)))
+            return -1;
+    }
+}
+
+int DatagramSocket::recvMany(Datagram* msgs, std::size_t count, Clock::time_point deadline)
+{
+    std::size_t total = 0;
+
+    while (total < count) {
+        std::size_t batch = std::min(count - total, MAX_BATCH);
+        int r = recvBatch(d_handle, msgs + total, batch, d_receiveOffload);
+
+        if (r < 0) {
+            if (total > 0)
+                break;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+            if (!waited(d_poll.waitRead(deadline)))
+                return -1;
+            continue;
+        }
+
+        total += r;
+        // queue is drained
+        if (static_cast<std::size_t>(r) < batch)
+            break;
+    }
+
+    return total;
+}
+
+int DatagramSocket::sendMany(const Datagram* msgs, std::size_t count,
+        Clock::time_point deadline)
+{
+    std::size_t total = 0;
+
+    while (total < count) {
+        int r = sendBatch(d_handle, msgs + total, count - total);
+
+        if (r < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return total > 0 ? total : -1;
+            if (!waited(d_poll.waitWrite(deadline)))
+                return total > 0 ? total : -1;
+            continue;
+        }
+
+        total += r;
+    }
+
+    return total;
+}
+
+int DatagramSocket::setSegmentSize(uint16_t segment)
+{
+#ifdef UDP_SEGMENT
+    int size = segment;
+    if (setsockopt(d_handle, IPPROTO_UDP, UDP_SEGMENT, &size, sizeof(size)) != 0)
+        return errno;
+    return 0;
+#else
+    return segment != 0 ? ENOPROTOOPT : 0;
+#endif
+}
+
+int DatagramSocket::setReceiveOffload(bool enable)
+{
+#ifdef UDP_GRO
+    int value = enable ? 1 : 0;
+    if (setsockopt(d_handle, IPPROTO_UDP, UDP_GRO, &value, sizeof(value)) != 0)
+        return errno;
+
+    d_receiveOffload = enable;
+    return 0;
+#else
+    return enable ? ENOPROTOOPT : 0;
+#endif
+}
+
+}
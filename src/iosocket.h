@@ -1,6 +1,12 @@
 #pragma once
 #include "iocoro.h"
 
+#include <string>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
 namespace iocoro
 {
 
@@ -37,10 +43,47 @@ struct IP4Endpoint
     uint16_t port;
 };
 
+// Address of any supported family: IPv4, IPv6 or a Unix domain socket
+class Endpoint
+{
+    union
+    {
+        sockaddr sa;
+        sockaddr_in in4;
+        sockaddr_in6 in6;
+        sockaddr_un un;
+    } d_addr;
+    socklen_t d_len{0};
+
+public:
+    // unspecified, family() is AF_UNSPEC
+    Endpoint();
+    Endpoint(const IP4Endpoint& ep);
+    Endpoint(const sockaddr* addr, socklen_t len);
+
+    // numeric IPv6 address, e.g. "::1", unspecified if it does not parse
+    static Endpoint ip6(const char* addr, uint16_t port);
+    // AF_UNIX path, a leading '\0' selects the Linux abstract namespace,
+    // unspecified if the path is too long
+    static Endpoint local(const std::string& path);
+
+    int family() const { return d_addr.sa.sa_family; }
+    const sockaddr* sockAddr() const { return &d_addr.sa; }
+    socklen_t size() const { return d_len; }
+    // 0 for AF_UNIX
+    uint16_t port() const;
+    // AF_INET address, invalid IP4Endpoint for other families
+    IP4Endpoint ip4() const;
+    // AF_UNIX path, empty for unnamed sockets and other families
+    std::string path() const;
+
+    friend bool operator == (const Endpoint& a, const Endpoint& b);
+};
+
 struct IncomingConnection
 {
     FileHandle handle;
-    IP4Endpoint endpoint;
+    Endpoint endpoint;
 };
 
 struct IoVec 
@@ -49,33 +92,198 @@ struct IoVec
     std::size_t len;
 };
 
-class Connection
+// One datagram of DatagramSocket::recvMany()/sendMany() batch
+struct Datagram
+{
+    // receive buffer, or data to send
+    IoVec buf;
+    // received size, longer datagrams are truncated to buf.len
+    std::size_t size{0};
+    // source on receive, destination on send (port 0 sends to the
+    // connected peer)
+    IP4Endpoint endpoint;
+    // with receive offload buf may hold several datagrams coalesced
+    // by the kernel, each segmentSize bytes but the last; 0 otherwise
+    uint16_t segmentSize{0};
+};
+
+// Blocking calls fail with ECANCELED when the context is interrupted
+// (see Context::interrupt()), calls taking a deadline fail with
+// ETIMEDOUT once it passes; data may have been partially sent then.
+//
+// Several contexts may use a connection at once. Reads are served in
+// the order the contexts started waiting, data of writeAll() and other
+// sends is not interleaved.
+class Connection: public Flushable
 {
     FileHandle d_handle;
     ContextPoll d_poll;
-    IP4Endpoint d_remoteAddr;
+    Endpoint d_remoteAddr;
+    // socket from connect() or accept() that was never passed on,
+    // closing it drops it from the poller, see releasePoll()
+    bool d_ownsSocket{false};
+
+    // MSG_ZEROCOPY state, threshold 0 means disabled
+    std::size_t d_zeroCopyThreshold{0};
+    uint32_t d_zeroCopySent{0};
+    uint32_t d_zeroCopyReleased{0};
+
+    // corked output, see setCorked()
+    bool d_corked{false};
+    std::vector<char> d_corkBuffer;
+    // error of a flush done by the dispatcher, reported by the next write
+    int d_corkError{0};
+
+    // writeAll() in progress, others wait for it to finish
+    class WriteGuard;
+    bool d_writing{false};
+    WaitQueue d_writers;
+
+    void setHandle(FileHandle&& handle);
+    void adopt(int fd);
+    void releasePoll();
+    int reapZeroCopy();
+    int cork(const char* buf, std::size_t sz);
+    // callers hold WriteGuard
+    int writeAllDirect(IoVec* buf, std::size_t count, Clock::time_point deadline);
+    int flushLocked(Clock::time_point deadline);
+    int sendZeroCopyLocked(const char* buf, std::size_t sz, Clock::time_point deadline);
+    virtual bool flushPending(Poller& poller) override;
+
+    friend class Listener;
 public:
+    // larger corked writes are sent right away
+    static const std::size_t CORK_LIMIT = 64 * 1024;
+    static const std::size_t MAX_PASSED_FDS = 64;
+
     Connection(int fd = -1);
+    ~Connection();
 
     void attach(int fd);
-    void setRemoteAddress(const IP4Endpoint& ep) { d_remoteAddr = ep; }
+    void setRemoteAddress(const Endpoint& ep) { d_remoteAddr = ep; }
 
     // accessors
-    IP4Endpoint remoteAddress() const { return d_remoteAddr; }
+    // asks the socket if the address was not set
+    Endpoint remoteAddress() const;
+    // poller syscalls spent on this socket, sockets that never block
+    // are not registered at all
+    const PollStats& pollStats() const { return d_poll.stats(); }
 
     // returns 0 if success, error otherwise
-    int connect(const IP4Endpoint& endpoint);
-    int read(char* buf, std::size_t sz);
-    int writeAll(const char* buf, std::size_t sz);
-    int writeAll(IoVec* buf, std::size_t count);
+    int connect(const Endpoint& endpoint, 
+            Clock::time_point deadline = Clock::time_point::max());
+    int read(char* buf, std::size_t sz, 
+            Clock::time_point deadline = Clock::time_point::max());
+    // scatter read, returns as soon as some data is available
+    int readv(IoVec* buf, std::size_t count, 
+            Clock::time_point deadline = Clock::time_point::max());
+    // fills all buffers, returns total size, 0 on eof or -1 on error,
+    // buf array is modified
+    int readAll(IoVec* buf, std::size_t count, 
+            Clock::time_point deadline = Clock::time_point::max());
+    // return total size written or -1 on error
+    int writeAll(const char* buf, std::size_t sz, 
+            Clock::time_point deadline = Clock::time_point::max());
+    // gather write, buf array is modified to track progress
+    int writeAll(IoVec* buf, std::size_t count, 
+            Clock::time_point deadline = Clock::time_point::max());
+    // Sends len bytes of file fd starting at offset without copying
+    // them through user space. Returns size sent, less than len if
+    // the file ends earlier, or -1 on error.
+    int64_t sendFile(int fd, uint64_t offset, std::size_t len,
+            Clock::time_point deadline = Clock::time_point::max());
+    // Moves up to len bytes received on this connection to dst through
+    // a pooled pipe, returns size moved (less than len on eof) or -1.
+    int64_t spliceTo(Connection& dst, std::size_t len,
+            Clock::time_point deadline = Clock::time_point::max());
     void shutdown();
 
+    // Writes of at least threshold bytes are sent with MSG_ZEROCOPY,
+    // writeAll() then returns once the kernel has released the buffer.
+    // Returns 0 if success, error otherwise (e.g. unsupported).
+    int setZeroCopy(bool enable, std::size_t threshold = 64 * 1024);
+    // Sends buf with MSG_ZEROCOPY, buf must stay unchanged until
+    // waitZeroCopy() returns. Returns sz or -1 on error.
+    int sendZeroCopy(const char* buf, std::size_t sz,
+            Clock::time_point deadline = Clock::time_point::max());
+    // suspends until all zero-copy sends have been released,
+    // returns 0 or -1 on error
+    int waitZeroCopy(Clock::time_point deadline = Clock::time_point::max());
+
+    // Unix domain sockets only: sends buf (at least one byte) together
+    // with count descriptors (SCM_RIGHTS), up to MAX_PASSED_FDS.
+    // Returns sz or -1 on error.
+    int sendFds(const char* buf, std::size_t sz, const int* fds, std::size_t count,
+            Clock::time_point deadline = Clock::time_point::max());
+    // Reads like read() and takes descriptors passed with the data,
+    // up to max, count is set to the number received
+    int recvFds(char* buf, std::size_t sz, FileHandle* fds, std::size_t max, std::size_t& count,
+            Clock::time_point deadline = Clock::time_point::max());
+
+    // In corked mode writeAll() only appends to a buffer, the dispatcher
+    // sends all data queued by its contexts with one write per loop
+    // iteration, right before it polls. Other sends flush it first.
+    void setCorked(bool corked);
+    // sends corked data now, returns 0 or -1 on error
+    int flush(Clock::time_point deadline = Clock::time_point::max());
+
     // noncopyable
     Connection(const Connection&) = delete;
     Connection& operator = (const Connection&) = delete;
 
 };
 
+// Buffered reads and writes on top of a Connection. Buffers come
+// from the dispatcher's BufferPool, so the adaptor must be used by
+// contexts of the dispatcher it was created in.
+class BufferedConnection
+{
+    Connection& d_conn;
+    BufferPool& d_pool;
+
+    char* d_readBuf{nullptr};
+    std::size_t d_readBegin{0};
+    std::size_t d_readEnd{0};
+    // bytes after d_readBegin already searched by readUntil()
+    std::size_t d_scanned{0};
+
+    char* d_writeBuf{nullptr};
+    std::size_t d_writeSize{0};
+
+    // reads more data into the read buffer, returns size read,
+    // 0 on eof or -1 on error
+    int fill();
+
+public:
+    explicit BufferedConnection(Connection& conn);
+    // does not flush, returns buffers to the pool
+    ~BufferedConnection();
+
+    Connection& connection() { return d_conn; }
+
+    // Reads up to and including delim. data points into the read buffer
+    // and stays valid until the next read. Returns line size, 0 on eof
+    // or -1 on error; EMSGSIZE if no delim fits into one buffer.
+    int readUntil(char delim, const char*& data);
+    // reads exactly n bytes, returns n, less on eof, or -1 on error
+    int readExactly(char* buf, std::size_t n);
+    // waits for data if none is buffered, does not consume it,
+    // returns size available, 0 on eof or -1 on error
+    int peek(const char*& data);
+    // drops n bytes returned by peek()
+    void consume(std::size_t n);
+
+    // Appends to the write buffer, which is flushed when full.
+    // Returns sz or -1 on error.
+    int write(const char* buf, std::size_t sz);
+    // writes buffered data with one syscall, returns 0 or -1 on error
+    int flush();
+
+    // noncopyable
+    BufferedConnection(const BufferedConnection&) = delete;
+    BufferedConnection& operator = (const BufferedConnection&) = delete;
+};
+
 class Listener
 {
     FileHandle d_handle;
@@ -84,9 +292,75 @@ public:
 
     Listener();
 
-    int bind(const IP4Endpoint& endpoint);
+    // creates the socket for the endpoint's family, a Unix socket path
+    // must not exist yet. Returns 0 if success, error otherwise.
+    int bind(const Endpoint& endpoint);
     int listen(int backlog);
-    bool accept(Connection& conn);
+    // false on error, errno is ETIMEDOUT once deadline passes or
+    // ECANCELED if the context is interrupted
+    bool accept(Connection& conn, Clock::time_point deadline = Clock::time_point::max());
+    // Waits for at least one connection, then takes whatever else is
+    // queued in the backlog, up to max. Returns 0 on error.
+    std::size_t acceptMany(IncomingConnection* out, std::size_t max,
+            Clock::time_point deadline = Clock::time_point::max());
+    // Accept loop: runs handler in a new context for every connection,
+    // accepting up to batch connections per wakeup.
+    // Returns error if accept fails, otherwise never returns.
+    int serve(std::function<void(Connection&)>&& handler, std::size_t batch = 64);
+    void shutdown();
+};
+
+// UDP socket. Batched calls use recvmmsg/sendmmsg where available,
+// up to MAX_BATCH datagrams per syscall.
+// Like Connection's, calls fail with ETIMEDOUT once deadline passes.
+class DatagramSocket
+{
+    FileHandle d_handle;
+    ContextPoll d_poll;
+    bool d_receiveOffload{false};
+
+public:
+    static const std::size_t MAX_BATCH = 32;
+
+    DatagramSocket();
+
+    // returns 0 if success, error otherwise
+    int bind(const IP4Endpoint& endpoint);
+    // sets default destination and filters incoming datagrams,
+    // returns 0 if success, error otherwise
+    int connect(const IP4Endpoint& endpoint);
+    IP4Endpoint localEndpoint() const;
+
+    // return datagram size or -1 on error, from may be null
+    int recvFrom(char* buf, std::size_t sz, IP4Endpoint* from = nullptr,
+            Clock::time_point deadline = Clock::time_point::max());
+    // returns sz or -1 on error
+    int sendTo(const char* buf, std::size_t sz, const IP4Endpoint& to,
+            Clock::time_point deadline = Clock::time_point::max());
+    // sends to the connected peer
+    int send(const char* buf, std::size_t sz,
+            Clock::time_point deadline = Clock::time_point::max());
+
+    // Waits for at least one datagram, then takes whatever else is
+    // queued, up to count. Returns number received or -1 on error.
+    int recvMany(Datagram* msgs, std::size_t count,
+            Clock::time_point deadline = Clock::time_point::max());
+    // Sends all datagrams, returns count, less if an error stopped
+    // the batch midway, or -1 on error
+    int sendMany(const Datagram* msgs, std::size_t count,
+            Clock::time_point deadline = Clock::time_point::max());
+
+    // UDP_SEGMENT: sends larger than segment are split into datagrams
+    // of segment bytes by the kernel or NIC, 0 disables.
+    // Returns 0 if success, error otherwise (e.g. unsupported).
+    int setSegmentSize(uint16_t segment);
+    // UDP_GRO: recvMany() may return coalesced datagrams, see
+    // Datagram::segmentSize. Returns 0 if success, error otherwise.
+    int setReceiveOffload(bool enable);
+
+    // noncopyable
+    DatagramSocket(const DatagramSocket&) = delete;
+    DatagramSocket& operator = (const DatagramSocket&) = delete;
 };
 
 
@@ -0,0 +1,226 @@
+#include "iostack.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+
+#include <boost/context/stack_traits.hpp>
+
+namespace ctx = boost::context;
+
+namespace iocoro
+{
+
+namespace {
+
+// address space reserved at once by the pooled allocator
+const std::size_t SLAB_SIZE = 2 * 1024 * 1024;
+
+#ifdef MAP_NORESERVE
+const int MMAP_FLAGS = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#else
+const int MMAP_FLAGS = MAP_PRIVATE | MAP_ANONYMOUS;
+#endif
+
+std::size_t pageSize()
+{
+    return ctx::stack_traits::page_size();
+}
+
+// counts resident pages of [begin, end), range is shrunk to page boundaries
+std::size_t residentBytes(const char* begin, const char* end)
+{
+    const std::size_t page = pageSize();
+    uintptr_t b = (reinterpret_cast<uintptr_t>(begin) + page - 1) & ~(page - 1);
+    uintptr_t e = reinterpret_cast<uintptr_t>(end) & ~(page - 1);
+    if (e <= b)
+        return 0;
+
+#ifdef __APPLE__
+    typedef char MincoreVec;
+#else
+    typedef unsigned char MincoreVec;
+#endif
+
+    std::size_t pages = (e - b) / page;
+    std::vector<MincoreVec> vec(pages);
+    if (mincore(reinterpret_cast<void*>(b), e - b, vec.data()) != 0) {
+        return 0;
+    }
+
+    std::size_t resident = std::count_if(vec.begin(), vec.end(),
+            [](MincoreVec v) { return (v & 1) != 0; });
+    return resident * page;
+}
+
+}
+
+StackAllocator::StackAllocator(const StackPolicy& policy)
+: d_policy(policy)
+{
+    const std::size_t page = pageSize();
+
+    if (d_policy.size == 0)
+        d_policy.size = ctx::stack_traits::default_size();
+
+    // stack_traits::minimum_size() follows MINSIGSTKSZ, which is far above
+    // what a coroutine needs, so only guarantee a couple of pages
+    d_policy.size = std::max(d_policy.size, 2 * page);
+
+    std::size_t pages = (d_policy.size + page - 1) / page;
+    d_stride = (pages + (d_policy.guardPage ? 1 : 0)) * page;
+}
+
+StackAllocator::~StackAllocator()
+{
+    for (auto& slab : d_slabs) {
+        munmap(slab.base, slab.size);
+    }
+
+    for (void* sp : d_stacks) {
+        ctx::stack_context sctx;
+        sctx.sp = sp;
+        sctx.size = d_stride;
+        deallocateSingle(sctx);
+    }
+}
+
+void StackAllocator::addSlab()
+{
+    std::size_t count = std::max<std::size_t>(1, SLAB_SIZE / d_stride);
+    std::size_t size = count * d_stride;
+
+    void* vp = mmap(0, size, PROT_READ | PROT_WRITE, MMAP_FLAGS, -1, 0);
+    if (vp == MAP_FAILED)
+        throw std::bad_alloc();
+
+    char* base = static_cast<char*>(vp);
+    d_slabs.push_back(Slab{base, size});
+    d_reserved += size;
+
+    // push in reverse, so stacks are handed out in address order
+    for (std::size_t i = count; i-- > 0;) {
+        char* bottom = base + i * d_stride;
+        if (d_policy.guardPage) {
+            mprotect(bottom, pageSize(), PROT_NONE);
+        }
+
+        // free list node lives at the top of the unused stack
+        FreeStack* node = reinterpret_cast<FreeStack*>(bottom + d_stride) - 1;
+        node->next = d_freeList;
+        d_freeList = node;
+        ++d_free;
+    }
+}
+
+ctx::stack_context StackAllocator::allocateSingle()
+{
+    void* vp = nullptr;
+
+    if (d_policy.guardPage) {
+        vp = mmap(0, d_stride, PROT_READ | PROT_WRITE, MMAP_FLAGS, -1, 0);
+        if (vp == MAP_FAILED)
+            throw std::bad_alloc();
+        mprotect(vp, pageSize(), PROT_NONE);
+    } else {
+        vp = malloc(d_stride);
+        if (vp == nullptr)
+            throw std::bad_alloc();
+    }
+
+    ctx::stack_context sctx;
+    sctx.size = d_stride;
+    sctx.sp = static_cast<char*>(vp) + d_stride;
+
+    d_stacks.insert(sctx.sp);
+    d_reserved += d_stride;
+    return sctx;
+}
+
+void StackAllocator::deallocateSingle(ctx::stack_context& sctx)
+{
+    void* vp = static_cast<char*>(sctx.sp) - sctx.size;
+
+    if (d_policy.guardPage) {
+        munmap(vp, sctx.size);
+    } else {
+        free(vp);
+    }
+
+    d_reserved -= sctx.size;
+}
+
+ctx::stack_context StackAllocator::allocate()
+{
+    ++d_inUse;
+
+    if (!d_policy.pooled)
+        return allocateSingle();
+
+    if (d_freeList == nullptr)
+        addSlab();
+
+    FreeStack* node = d_freeList;
+    d_freeList = node->next;
+    --d_free;
+
+    ctx::stack_context sctx;
+    sctx.size = d_stride;
+    sctx.sp = node + 1;
+    return sctx;
+}
+
+void StackAllocator::deallocate(ctx::stack_context& sctx)
+{
+    assert(sctx.sp != nullptr);
+    --d_inUse;
+
+    if (!d_policy.pooled) {
+        d_stacks.erase(sctx.sp);
+        deallocateSingle(sctx);
+        return;
+    }
+
+    FreeStack* node = static_cast<FreeStack*>(sctx.sp) - 1;
+    node->next = d_freeList;
+    d_freeList = node;
+    ++d_free;
+}
+
+StackStats StackAllocator::stats() const
+{
+    StackStats st;
+    st.inUse = d_inUse;
+    st.free = d_free;
+    st.reserved = d_reserved;
+
+    for (auto& slab : d_slabs) {
+        st.committed += residentBytes(slab.base, slab.base + slab.size);
+    }
+
+    for (void* sp : d_stacks) {
+        const char* top = static_cast<const char*>(sp);
+        st.committed += residentBytes(top - d_stride, top);
+    }
+
+    return st;
+}
+
+void StackAllocator::trim()
+{
+    const std::size_t page = pageSize();
+
+    for (FreeStack* node = d_freeList; node != nullptr; node = node->next) {
+        // keep the top page, it holds the free list link
+        char* top = reinterpret_cast<char*>(node + 1);
+        char* bottom = top - d_stride + (d_policy.guardPage ? page : 0);
+        madvise(bottom, top - page - bottom, MADV_DONTNEED);
+    }
+}
+
+}
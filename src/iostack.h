@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/context/stack_context.hpp>
+
+namespace iocoro
+{
+
+// How coroutine stacks are allocated by a Dispatcher
+struct StackPolicy
+{
+    // usable stack size in bytes, 0 selects boost default
+    std::size_t size{0};
+    // put a PROT_NONE page below every stack, so overflow faults
+    // instead of silently corrupting memory
+    bool guardPage{false};
+    // carve stacks from large mmap'ed slabs and keep released
+    // stacks in a free list instead of returning them to the system
+    bool pooled{false};
+};
+
+struct StackStats
+{
+    std::size_t inUse{0};       // stacks owned by contexts
+    std::size_t free{0};        // released stacks kept by the pool
+    std::size_t reserved{0};    // bytes of address space taken by stacks
+    std::size_t committed{0};   // bytes of stacks backed by physical memory
+};
+
+class StackAllocator
+{
+    struct Slab
+    {
+        char* base;
+        std::size_t size;
+    };
+
+    struct FreeStack
+    {
+        FreeStack* next;
+    };
+
+    StackPolicy d_policy;
+    std::size_t d_stride;       // stack size including guard page
+    std::size_t d_reserved{0};
+    std::size_t d_inUse{0};
+    std::size_t d_free{0};
+
+    FreeStack* d_freeList{nullptr};
+    std::vector<Slab> d_slabs;
+    // stacks allocated one by one, keyed by sp
+    std::unordered_set<void*> d_stacks;
+
+    void addSlab();
+    boost::context::stack_context allocateSingle();
+    void deallocateSingle(boost::context::stack_context& sctx);
+
+public:
+    explicit StackAllocator(const StackPolicy& policy);
+    ~StackAllocator();
+
+    const StackPolicy& policy() const { return d_policy; }
+
+    boost::context::stack_context allocate();
+    void deallocate(boost::context::stack_context& sctx);
+
+    // walks every stack with mincore(), not meant for hot paths
+    StackStats stats() const;
+    // returns memory of pooled free stacks to the system,
+    // their address space stays reserved for reuse
+    void trim();
+
+    // copyable reference passed to boost::context::callcc
+    class Ref
+    {
+        StackAllocator* d_alloc;
+    public:
+        Ref(StackAllocator& alloc) : d_alloc(&alloc) {}
+
+        boost::context::stack_context allocate() { return d_alloc->allocate(); }
+        void deallocate(boost::context::stack_context& sctx) { d_alloc->deallocate(sctx); }
+    };
+
+    // noncopyable
+    StackAllocator(const StackAllocator&) = delete;
+    StackAllocator& operator = (const StackAllocator&) = delete;
+};
+
+}
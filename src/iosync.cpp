@@ -0,0 +1,224 @@
+#include "iosync.h"
+
+#include <errno.h>
+
+namespace iocoro
+{
+
+//////////////////////////////////////////////////////////////////////////
+// class Mutex
+//////////////////////////////////////////////////////////////////////////
+bool Mutex::lock()
+{
+    return try_lock_for(Clock::duration::max());
+}
+
+bool Mutex::try_lock()
+{
+    if (d_locked)
+        return false;
+
+    d_locked = true;
+    return true;
+}
+
+bool Mutex::try_lock_for(Clock::duration d)
+{
+    if (try_lock())
+        return true;
+
+    auto deadline = d == Clock::duration::max() ? 
+        Clock::time_point::max() : Clock::now() + d;
+
+    // unlock() hands the mutex over without unlocking it
+    return d_waiters.wait(deadline);
+}
+
+void Mutex::unlock()
+{
+    if (Context* next = d_waiters.dequeue()) {
+        next->enable();
+    } else {
+        d_locked = false;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// class SharedMutex
+//////////////////////////////////////////////////////////////////////////
+void SharedMutex::wakeReaders()
+{
+    while (Context* ctx = d_readers.dequeue()) {
+        ++d_readerCount;
+        ctx->enable();
+    }
+}
+
+bool SharedMutex::lock()
+{
+    return try_lock_for(Clock::duration::max());
+}
+
+bool SharedMutex::try_lock()
+{
+    if (d_writer || d_readerCount != 0)
+        return false;
+
+    d_writer = true;
+    return true;
+}
+
+bool SharedMutex::try_lock_for(Clock::duration d)
+{
+    if (d_writers.empty() && try_lock())
+        return true;
+
+    auto deadline = d == Clock::duration::max() ? 
+        Clock::time_point::max() : Clock::now() + d;
+
+    if (d_writers.wait(deadline))
+        return true;
+
+    // readers queued behind the last writer must not wait for nothing
+    if (d_writers.empty() && !d_writer) {
+        wakeReaders();
+    }
+    return false;
+}
+
+void SharedMutex::unlock()
+{
+    d_writer = false;
+
+    // let readers waiting meanwhile in first, then the next writer
+    if (!d_readers.empty()) {
+        wakeReaders();
+    } else if (Context* next = d_writers.dequeue()) {
+        d_writer = true;
+        next->enable();
+    }
+}
+
+bool SharedMutex::lock_shared()
+{
+    return try_lock_shared_for(Clock::duration::max());
+}
+
+bool SharedMutex::try_lock_shared()
+{
+    // waiting writers block new readers, so they do not starve
+    if (d_writer || !d_writers.empty())
+        return false;
+
+    ++d_readerCount;
+    return true;
+}
+
+bool SharedMutex::try_lock_shared_for(Clock::duration d)
+{
+    if (try_lock_shared())
+        return true;
+
+    auto deadline = d == Clock::duration::max() ? 
+        Clock::time_point::max() : Clock::now() + d;
+
+    // wakeReaders() counts the reader in
+    return d_readers.wait(deadline);
+}
+
+void SharedMutex::unlock_shared()
+{
+    if (--d_readerCount != 0)
+        return;
+
+    if (Context* next = d_writers.dequeue()) {
+        d_writer = true;
+        next->enable();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// class Semaphore
+//////////////////////////////////////////////////////////////////////////
+bool Semaphore::acquire()
+{
+    return try_acquire_for(Clock::duration::max());
+}
+
+bool Semaphore::try_acquire()
+{
+    if (d_count == 0 || !d_waiters.empty())
+        return false;
+
+    --d_count;
+    return true;
+}
+
+bool Semaphore::try_acquire_for(Clock::duration d)
+{
+    if (try_acquire())
+        return true;
+
+    auto deadline = d == Clock::duration::max() ? 
+        Clock::time_point::max() : Clock::now() + d;
+
+    // release() passes its unit directly to the waiter
+    return d_waiters.wait(deadline);
+}
+
+void Semaphore::release()
+{
+    if (Context* next = d_waiters.dequeue()) {
+        next->enable();
+    } else {
+        ++d_count;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// class ConditionVariable
+//////////////////////////////////////////////////////////////////////////
+void ConditionVariable::notify_one()
+{
+    if (Context* ctx = d_waiters.dequeue()) {
+        ctx->enable();
+    }
+}
+
+void ConditionVariable::notify_all()
+{
+    d_waiters.notifyAll();
+}
+
+bool ConditionVariable::wait(std::unique_lock<Mutex>& lock)
+{
+    return wait_for(lock, Clock::duration::max());
+}
+
+bool ConditionVariable::wait_for(std::unique_lock<Mutex>& lock, Clock::duration d)
+{
+    auto deadline = d == Clock::duration::max() ? 
+        Clock::time_point::max() : Clock::now() + d;
+
+    // nothing can run between unlock and enqueueing the waiter,
+    // so no notification is lost
+    Mutex& m = *lock.release();
+    m.unlock();
+    bool notified = d_waiters.wait(deadline);
+    int error = errno;
+
+    // the caller expects the lock back, so reacquiring it is not
+    // interruptible, an interrupt meanwhile stays pending
+    bool interrupted = false;
+    while (!m.lock()) {
+        interrupted = true;
+    }
+    lock = std::unique_lock<Mutex>(m, std::adopt_lock);
+    if (interrupted)
+        Context::self()->interrupt();
+
+    errno = error;
+    return notified;
+}
+
+}
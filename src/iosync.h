@@ -0,0 +1,112 @@
+#pragma once
+#include "iocoro.h"
+
+#include <mutex>
+
+namespace iocoro
+{
+
+// Synchronization between contexts of one dispatcher. Nothing here
+// calls into the OS, waiting costs linking a node into a WaitQueue.
+// Ownership is handed over to waiters in FIFO order, so late comers
+// can not overtake contexts that already wait.
+//
+// Waits fail with errno ECANCELED when the context is interrupted (see
+// Context::interrupt()), callers that may be interrupted have to check
+// the result of lock() and acquire(), std::lock_guard does not.
+
+class Mutex
+{
+    WaitQueue d_waiters;
+    bool d_locked{false};
+
+public:
+    // false if interrupted
+    bool lock();
+    bool try_lock();
+    // returns false on timeout or interrupt
+    bool try_lock_for(Clock::duration d);
+    void unlock();
+};
+
+// Readers share the lock, a waiting writer blocks new readers.
+class SharedMutex
+{
+    WaitQueue d_writers;
+    WaitQueue d_readers;
+    std::size_t d_readerCount{0};
+    bool d_writer{false};
+
+    void wakeReaders();
+
+public:
+    // false if interrupted
+    bool lock();
+    bool try_lock();
+    bool try_lock_for(Clock::duration d);
+    void unlock();
+
+    bool lock_shared();
+    bool try_lock_shared();
+    bool try_lock_shared_for(Clock::duration d);
+    void unlock_shared();
+};
+
+class Semaphore
+{
+    WaitQueue d_waiters;
+    std::size_t d_count;
+
+public:
+    explicit Semaphore(std::size_t count = 0) : d_count(count) {}
+
+    // false if interrupted
+    bool acquire();
+    bool try_acquire();
+    // returns false on timeout or interrupt
+    bool try_acquire_for(Clock::duration d);
+    void release();
+
+    std::size_t count() const { return d_count; }
+};
+
+class ConditionVariable
+{
+    WaitQueue d_waiters;
+
+public:
+    void notify_one();
+    void notify_all();
+
+    // false if interrupted
+    bool wait(std::unique_lock<Mutex>& lock);
+    // returns false on timeout or interrupt, the lock is reacquired
+    // in all cases
+    bool wait_for(std::unique_lock<Mutex>& lock, Clock::duration d);
+
+    // false if interrupted before pred() holds
+    template <class Predicate>
+    bool wait(std::unique_lock<Mutex>& lock, Predicate pred)
+    {
+        while (!pred()) {
+            if (!wait(lock))
+                return false;
+        }
+        return true;
+    }
+
+    // returns pred() result after timeout
+    template <class Predicate>
+    bool wait_for(std::unique_lock<Mutex>& lock, Clock::duration d, Predicate pred)
+    {
+        auto deadline = Clock::now() + d;
+        while (!pred()) {
+            auto now = Clock::now();
+            if (now >= deadline || !wait_for(lock, deadline - now))
+                return pred();
+        }
+        return true;
+    }
+};
+
+}
@@ -0,0 +1,472 @@
+#include "iouring.h"
+#include "iocoro.h"
+
+#ifdef IOCORO_WITH_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace iocoro
+{
+
+namespace {
+
+const std::size_t MAX_REGISTERED_FILES = 4096;
+const std::chrono::milliseconds CANCEL_RETRY(1);
+
+int sysSetup(unsigned entries, io_uring_params* p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+int sysRegister(int fd, unsigned opcode, const void* arg, unsigned nrArgs)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+template <class T>
+T* at(void* base, uint32_t offset)
+{
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+unsigned loadAcquire(const unsigned* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned* p, unsigned v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+// class IoUring
+//////////////////////////////////////////////////////////////////////////
+IoUring::IoUring(int fd)
+: FilePoll(fd), d_ring(fd)
+{
+}
+
+IoUring::~IoUring()
+{
+    if (d_sqeMap.ptr)
+        munmap(d_sqeMap.ptr, d_sqeMap.size);
+    if (d_cqMap.ptr && d_cqMap.ptr != d_sqMap.ptr)
+        munmap(d_cqMap.ptr, d_cqMap.size);
+    if (d_sqMap.ptr)
+        munmap(d_sqMap.ptr, d_sqMap.size);
+}
+
+IoUring* IoUring::current()
+{
+    Context* ctx = Context::self();
+    return ctx ? ctx->dispatcher().getIoUring() : nullptr;
+}
+
+std::unique_ptr<IoUring> IoUring::create(unsigned entries, bool registerFiles)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = sysSetup(entries, &params);
+    if (fd < 0)
+        return nullptr;
+
+    std::unique_ptr<IoUring> ring(new IoUring(fd));
+    if (!ring->init(params, registerFiles))
+        return nullptr;
+
+    return ring;
+}
+
+bool IoUring::init(const io_uring_params& p, bool registerFiles)
+{
+    d_sqMap.size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    d_cqMap.size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+    bool singleMmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+        d_sqMap.size = d_cqMap.size = std::max(d_sqMap.size, d_cqMap.size);
+    }
+
+    d_sqMap.ptr = mmap(0, d_sqMap.size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (d_sqMap.ptr == MAP_FAILED) {
+        d_sqMap.ptr = nullptr;
+        return false;
+    }
+
+    if (singleMmap) {
+        d_cqMap.ptr = d_sqMap.ptr;
+    } else {
+        d_cqMap.ptr = mmap(0, d_cqMap.size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (d_cqMap.ptr == MAP_FAILED) {
+            d_cqMap.ptr = nullptr;
+            return false;
+        }
+    }
+
+    d_sqeMap.size = p.sq_entries * sizeof(io_uring_sqe);
+    d_sqeMap.ptr = mmap(0, d_sqeMap.size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (d_sqeMap.ptr == MAP_FAILED) {
+        d_sqeMap.ptr = nullptr;
+        return false;
+    }
+
+    d_sqHead = at<unsigned>(d_sqMap.ptr, p.sq_off.head);
+    d_sqTail = at<unsigned>(d_sqMap.ptr, p.sq_off.tail);
+    d_sqFlags = at<unsigned>(d_sqMap.ptr, p.sq_off.flags);
+    d_sqArray = at<unsigned>(d_sqMap.ptr, p.sq_off.array);
+    d_sqMask = *at<unsigned>(d_sqMap.ptr, p.sq_off.ring_mask);
+    d_sqEntries = *at<unsigned>(d_sqMap.ptr, p.sq_off.ring_entries);
+    d_sqes = static_cast<io_uring_sqe*>(d_sqeMap.ptr);
+    d_sqLocalTail = d_sqSubmitted = *d_sqTail;
+
+    d_cqHead = at<unsigned>(d_cqMap.ptr, p.cq_off.head);
+    d_cqTail = at<unsigned>(d_cqMap.ptr, p.cq_off.tail);
+    d_cqMask = *at<unsigned>(d_cqMap.ptr, p.cq_off.ring_mask);
+    d_cqes = at<io_uring_cqe>(d_cqMap.ptr, p.cq_off.cqes);
+
+    if (registerFiles) {
+        // sparse table, slots are filled on registerFile()
+        std::vector<int> fds(MAX_REGISTERED_FILES, -1);
+        if (sysRegister(fd, IORING_REGISTER_FILES, fds.data(), fds.size()) == 0) {
+            d_registerFiles = true;
+            for (std::size_t i = MAX_REGISTERED_FILES; i-- > 0;) {
+                d_freeSlots.push_back(i);
+            }
+        }
+    }
+
+    return true;
+}
+
+io_uring_sqe* IoUring::getSqe(Op& op, uint8_t opcode, int fd)
+{
+    if (d_sqLocalTail - loadAcquire(d_sqHead) >= d_sqEntries) {
+        // queue is full, flush it right away
+        submit();
+
+        // the kernel may take no entries, e.g. EBUSY while completions
+        // overflow, make room for them and try once more
+        if (d_sqLocalTail - loadAcquire(d_sqHead) >= d_sqEntries) {
+            reap();
+            submit();
+        }
+
+        // a slot not consumed yet still holds a queued request
+        if (d_sqLocalTail - loadAcquire(d_sqHead) >= d_sqEntries) {
+            op.result = -EBUSY;
+            op.done = true;
+            return nullptr;
+        }
+    }
+
+    unsigned idx = d_sqLocalTail & d_sqMask;
+    io_uring_sqe* sqe = &d_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = reinterpret_cast<uint64_t>(&op);
+
+    if (d_registerFiles && fd >= 0
+            && static_cast<std::size_t>(fd) < d_fileSlots.size() && d_fileSlots[fd] != -1) {
+        sqe->fd = d_fileSlots[fd];
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+
+    d_sqArray[idx] = idx;
+    ++d_sqLocalTail;
+
+    op.done = false;
+    op.result = 0;
+    return sqe;
+}
+
+void IoUring::recv(Op& op, int fd, void* buf, std::size_t len, int flags)
+{
+    auto sqe = getSqe(op, IORING_OP_RECV, fd);
+    if (sqe == nullptr)
+        return;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+    sqe->msg_flags = flags;
+}
+
+void IoUring::send(Op& op, int fd, const void* buf, std::size_t len, int flags)
+{
+    auto sqe = getSqe(op, IORING_OP_SEND, fd);
+    if (sqe == nullptr)
+        return;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+    sqe->msg_flags = flags;
+}
+
+void IoUring::readv(Op& op, int fd, const iovec* iov, unsigned count, uint64_t offset)
+{
+    auto sqe = getSqe(op, IORING_OP_READV, fd);
+    if (sqe == nullptr)
+        return;
+    sqe->addr = reinterpret_cast<uint64_t>(iov);
+    sqe->len = count;
+    sqe->off = offset;
+}
+
+void IoUring::writev(Op& op, int fd, const iovec* iov, unsigned count, uint64_t offset)
+{
+    auto sqe = getSqe(op, IORING_OP_WRITEV, fd);
+    if (sqe == nullptr)
+        return;
+    sqe->addr = reinterpret_cast<uint64_t>(iov);
+    sqe->len = count;
+    sqe->off = offset;
+}
+
+void IoUring::read(Op& op, int fd, void* buf, std::size_t len, uint64_t offset)
+{
+    auto sqe = getSqe(op, IORING_OP_READ, fd);
+    if (sqe == nullptr)
+        return;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+    sqe->off = offset;
+}
+
+void IoUring::write(Op& op, int fd, const void* buf, std::size_t len, uint64_t offset)
+{
+    auto sqe = getSqe(op, IORING_OP_WRITE, fd);
+    if (sqe == nullptr)
+        return;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+    sqe->off = offset;
+}
+
+void IoUring::fsync(Op& op, int fd, bool dataOnly)
+{
+    auto sqe = getSqe(op, IORING_OP_FSYNC, fd);
+    if (sqe == nullptr)
+        return;
+    sqe->fsync_flags = dataOnly ? IORING_FSYNC_DATASYNC : 0;
+}
+
+void IoUring::accept(Op& op, int fd, sockaddr* addr, socklen_t* len, int flags)
+{
+    auto sqe = getSqe(op, IORING_OP_ACCEPT, fd);
+    if (sqe == nullptr)
+        return;
+    sqe->addr = reinterpret_cast<uint64_t>(addr);
+    sqe->addr2 = reinterpret_cast<uint64_t>(len);
+    sqe->accept_flags = flags;
+}
+
+void IoUring::connect(Op& op, int fd, const sockaddr* addr, socklen_t len)
+{
+    auto sqe = getSqe(op, IORING_OP_CONNECT, fd);
+    if (sqe == nullptr)
+        return;
+    sqe->addr = reinterpret_cast<uint64_t>(addr);
+    sqe->off = len;
+}
+
+void IoUring::pollAdd(Op& op, int fd, uint32_t pollEvents)
+{
+    auto sqe = getSqe(op, IORING_OP_POLL_ADD, fd);
+    if (sqe == nullptr)
+        return;
+    sqe->poll_events = pollEvents;
+}
+
+bool IoUring::cancel(Op& op)
+{
+    Op dummy;
+    auto sqe = getSqe(dummy, IORING_OP_ASYNC_CANCEL, -1);
+    if (sqe == nullptr)
+        return false;
+
+    sqe->addr = reinterpret_cast<uint64_t>(&op);
+    // completion of the cancel request itself is ignored by reap()
+    sqe->user_data = 0;
+    return true;
+}
+
+int IoUring::wait(Op& op, Clock::time_point deadline)
+{
+    op.ctx = Context::self();
+    int error = 0;
+    bool cancelled = false;
+
+    if (Context::clearInterrupt())
+        error = ECANCELED;
+
+    while (!op.done) {
+        if (error && !cancelled)
+            cancelled = cancel(op);
+
+        // op lives on our stack, after cancelling wait for it regardless,
+        // a cancel that found the queue full is retried shortly
+        Clock::time_point until = deadline;
+        if (error)
+            until = cancelled ? Clock::time_point::max() : Clock::now() + CANCEL_RETRY;
+        op.ctx->schedule(until);
+        uint32_t flags = Context::yield();
+
+        if (op.done || error)
+            continue;
+
+        if ((flags & Flags::Interrupt) && Context::clearInterrupt()) {
+            error = ECANCELED;
+        } else if (flags & Flags::Schedule) {
+            error = ETIMEDOUT;
+        }
+    }
+
+    if (error && op.result == -ECANCELED)
+        op.result = -error;
+    return op.result;
+}
+
+int IoUring::submit()
+{
+    unsigned toSubmit = d_sqLocalTail - d_sqSubmitted;
+    if (toSubmit == 0)
+        return 0;
+
+    storeRelease(d_sqTail, d_sqLocalTail);
+
+    int r;
+    do {
+        r = sysEnter(fd, toSubmit, 0, 0);
+    } while (r < 0 && errno == EINTR);
+
+    if (r > 0) {
+        d_sqSubmitted += r;
+    }
+
+    return r;
+}
+
+void IoUring::reap()
+{
+    for (;;) {
+        unsigned head = *d_cqHead;
+        unsigned tail = loadAcquire(d_cqTail);
+
+        for (; head != tail; ++head) {
+            io_uring_cqe* cqe = &d_cqes[head & d_cqMask];
+            Op* op = reinterpret_cast<Op*>(cqe->user_data);
+            if (op == nullptr)
+                continue;
+
+            op->result = cqe->res;
+            op->done = true;
+            if (op->ctx != nullptr)
+                op->ctx->enable();
+        }
+
+        storeRelease(d_cqHead, head);
+
+        // completions that did not fit into the queue are kept by
+        // the kernel until the next enter
+        if (!(loadAcquire(d_sqFlags) & IORING_SQ_CQ_OVERFLOW))
+            break;
+        sysEnter(fd, 0, 0, IORING_ENTER_GETEVENTS);
+    }
+}
+
+void IoUring::handleEvents(uint32_t /*events*/)
+{
+    reap();
+}
+
+bool IoUring::registerFile(int fd)
+{
+    if (!d_registerFiles || fd < 0 || d_freeSlots.empty())
+        return false;
+
+    if (static_cast<std::size_t>(fd) >= d_fileSlots.size())
+        d_fileSlots.resize(fd + 1, -1);
+
+    if (d_fileSlots[fd] != -1)
+        return true;
+
+    int slot = d_freeSlots.back();
+    io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds = reinterpret_cast<uint64_t>(&fd);
+
+    if (sysRegister(this->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1)
+        return false;
+
+    d_freeSlots.pop_back();
+    d_fileSlots[fd] = slot;
+    return true;
+}
+
+void IoUring::unregisterFile(int fd)
+{
+    if (fd < 0 || static_cast<std::size_t>(fd) >= d_fileSlots.size() || d_fileSlots[fd] == -1)
+        return;
+
+    int slot = d_fileSlots[fd];
+    int none = -1;
+    io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.fds = reinterpret_cast<uint64_t>(&none);
+    sysRegister(this->fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+
+    d_fileSlots[fd] = -1;
+    d_freeSlots.push_back(slot);
+}
+
+}
+
+#else // IOCORO_WITH_URING
+
+namespace iocoro
+{
+
+// built without io_uring support, create() always fails
+
+IoUring::~IoUring()
+{
+}
+
+std::unique_ptr<IoUring> IoUring::create(unsigned entries, bool registerFiles)
+{
+    return nullptr;
+}
+
+IoUring* IoUring::current()
+{
+    return nullptr;
+}
+
+void IoUring::handleEvents(uint32_t /*events*/)
+{
+}
+
+}
+
+#endif // IOCORO_WITH_URING
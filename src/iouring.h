@@ -0,0 +1,123 @@
+#pragma once
+
+#include "iocoro.h"
+#include "iopoll.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_params;
+
+namespace iocoro
+{
+
+class Context;
+
+// Completion-based I/O through Linux io_uring, driven by raw syscalls.
+// Coroutines queue operations and suspend, the dispatcher submits all
+// queued operations once per loop iteration and resumes every context
+// straight from its completion. The ring fd itself is registered in the
+// Poller, so completions wake the dispatcher like any other event.
+class IoUring: public FilePoll
+{
+public:
+    // In-flight operation, lives on the stack of the waiting context.
+    // result is a negative errno on failure.
+    struct Op
+    {
+        Context* ctx{nullptr};
+        int result{0};
+        bool done{false};
+    };
+
+    // returns nullptr if io_uring is not supported by the kernel
+    static std::unique_ptr<IoUring> create(unsigned entries, bool registerFiles);
+    // ring of the current context's dispatcher, nullptr if not in use
+    static IoUring* current();
+    ~IoUring();
+
+    // Operations are only queued here, see submit(). If the queue is
+    // full and the kernel takes no entries, op completes with -EBUSY.
+    void recv(Op& op, int fd, void* buf, std::size_t len, int flags);
+    void send(Op& op, int fd, const void* buf, std::size_t len, int flags);
+    void readv(Op& op, int fd, const iovec* iov, unsigned count, uint64_t offset);
+    void writev(Op& op, int fd, const iovec* iov, unsigned count, uint64_t offset);
+    void read(Op& op, int fd, void* buf, std::size_t len, uint64_t offset);
+    void write(Op& op, int fd, const void* buf, std::size_t len, uint64_t offset);
+    void fsync(Op& op, int fd, bool dataOnly);
+    void accept(Op& op, int fd, sockaddr* addr, socklen_t* len, int flags);
+    void connect(Op& op, int fd, const sockaddr* addr, socklen_t len);
+    void pollAdd(Op& op, int fd, uint32_t pollEvents);
+
+    // Suspends current context until op completes, returns op.result.
+    // Once deadline passes or the context is interrupted the operation
+    // is cancelled, it fails with -ETIMEDOUT or -ECANCELED then unless
+    // it completed in the meantime.
+    int wait(Op& op, Clock::time_point deadline = Clock::time_point::max());
+
+    // submits queued operations, called by the dispatcher
+    int submit();
+    // resumes contexts of completed operations
+    void reap();
+    bool hasPending() const { return d_sqLocalTail != d_sqSubmitted; }
+
+    // Registered files save the kernel an fd table lookup per operation.
+    // Registered fd must be unregistered before it is closed, as the
+    // ring holds a reference to the file.
+    bool registerFile(int fd);
+    void unregisterFile(int fd);
+
+    // noncopyable
+    IoUring(const IoUring&) = delete;
+    IoUring& operator = (const IoUring&) = delete;
+
+private:
+    struct Mapping
+    {
+        void* ptr{nullptr};
+        std::size_t size{0};
+    };
+
+    FileHandle d_ring;
+    Mapping d_sqMap;
+    Mapping d_cqMap;
+    Mapping d_sqeMap;
+
+    // submission queue
+    unsigned* d_sqHead{nullptr};
+    unsigned* d_sqTail{nullptr};
+    unsigned* d_sqFlags{nullptr};
+    unsigned* d_sqArray{nullptr};
+    unsigned d_sqMask{0};
+    unsigned d_sqEntries{0};
+    io_uring_sqe* d_sqes{nullptr};
+    unsigned d_sqLocalTail{0};      // published to d_sqTail by submit()
+    unsigned d_sqSubmitted{0};
+
+    // completion queue
+    unsigned* d_cqHead{nullptr};
+    unsigned* d_cqTail{nullptr};
+    unsigned d_cqMask{0};
+    io_uring_cqe* d_cqes{nullptr};
+
+    // fd -> fixed file slot, -1 if not registered
+    bool d_registerFiles{false};
+    std::vector<int> d_fileSlots;
+    std::vector<int> d_freeSlots;
+
+    explicit IoUring(int fd);
+    bool init(const io_uring_params& params, bool registerFiles);
+    io_uring_sqe* getSqe(Op& op, uint8_t opcode, int fd);
+    // false if the queue is full
+    bool cancel(Op& op);
+
+    virtual void handleEvents(uint32_t events) override;
+};
+
+}
@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include <iocoro.h>
+
+#include <atomic>
+
+// Global operator new is replaced by iocountalloc.cpp, so these tests
+// run in their own executable and do not affect the other ones.
+
+using namespace iocoro;
+
+extern std::atomic<bool> g_counting;
+extern std::atomic<std::size_t> g_allocations;
+
+namespace {
+
+// counts heap allocations while in scope
+class AllocationCounter
+{
+public:
+    AllocationCounter()
+    {
+        g_allocations = 0;
+        g_counting = true;
+    }
+
+    ~AllocationCounter() { g_counting = false; }
+
+    std::size_t count() const { return g_allocations.load(); }
+};
+
+}
+
+TEST(Spawn, noAllocations)
+{
+    Dispatcher d;
+    std::size_t sum = 0;
+    std::size_t a = 1, b = 2, c = 3, e = 4, f = 5;
+
+    d.spawn([&] {
+        auto task = [&sum, &a, &b, &c, &e, &f] { sum += a + b + c + e + f; };
+
+        // warm up context pool
+        for (int i = 0; i < 10; ++i) {
+            d.spawn(task);
+        }
+
+        AllocationCounter counter;
+        for (int i = 0; i < 1000; ++i) {
+            d.spawn(task);
+        }
+        EXPECT_EQ(0u, counter.count());
+    });
+
+    d.dispatch();
+    EXPECT_EQ(1010 * 15, sum);
+}
@@ -1,6 +1,14 @@
 #include <gtest/gtest.h>
 #include <iocoro.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
 using namespace iocoro;
 
 TEST(Base, Success)
@@ -100,6 +108,117 @@ TEST(Base, NestedMany)
     EXPECT_EQ(outerLoop * innerLoop, spawns);
 }
 
+TEST(Spawn, largeAndMoveOnlyCaptures)
+{
+    Dispatcher d;
+    auto shared = std::make_shared<int>(0);
+    char big[InlineTask::CAPACITY * 2] = {1};
+    std::unique_ptr<int> owned(new int(5));
+    int result = 0;
+
+    // captures larger than inline storage go to the heap
+    d.spawn([&result, big, shared] { result += big[0]; });
+    // move-only captures are fine
+    d.spawn([&result, p = std::move(owned)] { result += *p; });
+
+    d.dispatch();
+
+    EXPECT_EQ(6, result);
+    // captures are destroyed as soon as the context finishes
+    EXPECT_EQ(1, shared.use_count());
+}
+
+void stackPolicyRun(const StackPolicy& policy)
+{
+    const int contexts = 100;
+    Dispatcher d(policy);
+    int finished = 0;
+
+    for (int i = 0; i < contexts; ++i) {
+        d.spawn([&] {
+            // touch some of the stack
+            char buf[4096];
+            memset(buf, 1, sizeof(buf));
+            Context::yield();
+            finished += buf[100];
+        });
+    }
+
+    d.dispatch();
+    EXPECT_EQ(contexts, finished);
+
+    auto st = d.stackStats();
+    EXPECT_EQ(contexts, st.inUse);
+    EXPECT_GE(st.reserved, contexts * 4096);
+    EXPECT_GT(st.committed, 0);
+    EXPECT_LE(st.committed, st.reserved);
+}
+
+TEST(Stack, defaultPolicy)
+{
+    stackPolicyRun(StackPolicy());
+}
+
+TEST(Stack, guardPage)
+{
+    StackPolicy policy;
+    policy.size = 32 * 1024;
+    policy.guardPage = true;
+    stackPolicyRun(policy);
+}
+
+TEST(Stack, pooled)
+{
+    StackPolicy policy;
+    policy.size = 16 * 1024;
+    policy.pooled = true;
+    policy.guardPage = true;
+    stackPolicyRun(policy);
+}
+
+TEST(Stack, poolReuse)
+{
+    StackPolicy policy;
+    policy.size = 16 * 1024;
+    policy.pooled = true;
+
+    StackAllocator alloc(policy);
+    auto s1 = alloc.allocate();
+    auto s2 = alloc.allocate();
+    EXPECT_NE(s1.sp, s2.sp);
+    EXPECT_EQ(2, alloc.stats().inUse);
+
+    auto reserved = alloc.stats().reserved;
+    alloc.deallocate(s1);
+    EXPECT_EQ(1, alloc.stats().inUse);
+
+    auto s3 = alloc.allocate();
+    EXPECT_EQ(s1.sp, s3.sp);
+    EXPECT_EQ(reserved, alloc.stats().reserved);
+
+    alloc.deallocate(s2);
+    alloc.deallocate(s3);
+    alloc.trim();
+    EXPECT_EQ(0, alloc.stats().inUse);
+}
+
+TEST(Buffer, poolReuse)
+{
+    BufferPool pool(4096);
+    char* b1 = pool.allocate();
+    char* b2 = pool.allocate();
+    EXPECT_NE(b1, b2);
+    EXPECT_EQ(2u, pool.inUse());
+    EXPECT_EQ(BufferPool::BUFFERS_PER_SLAB - 2, pool.free());
+
+    pool.deallocate(b1);
+    EXPECT_EQ(b1, pool.allocate());
+
+    pool.deallocate(b1);
+    pool.deallocate(b2);
+    EXPECT_EQ(0u, pool.inUse());
+}
+
 Clock::duration ms30 = std::chrono::milliseconds(30);
 Clock::duration ms50 = std::chrono::milliseconds(50);
 
@@ -145,6 +264,73 @@ TEST(Timer, severalTimeouts)
     d.dispatch();
 }
 
+TEST(Timer, wakeOrder)
+{
+    Dispatcher d;
+    std::vector<int> order;
+    const int sleepers = 50;
+
+    auto start = Clock::now();
+
+    // spawn in scrambled order, expect wakeups sorted by deadline
+    for (int i = 0; i < sleepers; ++i) {
+        int delay = (i * 37) % sleepers;
+        d.spawn([&, delay] {
+            Context::sleep_until(start + std::chrono::milliseconds(delay));
+            order.push_back(delay);
+        });
+    }
+
+    d.dispatch();
+
+    ASSERT_EQ(sleepers, order.size());
+    EXPECT_TRUE(std::is_sorted(order.begin(), order.end()));
+}
+
+TEST(Timer, cancelSleep)
+{
+    Dispatcher d;
+    Event e;
+    auto start = Clock::now();
+
+    // notification removes the waiter from the timer heap before its deadline
+    d.spawn([&] {
+        e.wait_for(std::chrono::seconds(10));
+        EXPECT_NEAR(30, elapsed(start), 10);
+    });
+
+    d.spawn([&] {
+        Context::sleep_for(ms30);
+        e.notify_one();
+    });
+
+    d.dispatch();
+
+    EXPECT_NEAR(30, elapsed(start), 10);
+}
+
+TEST(Timer, interruptSleep)
+{
+    Dispatcher d;
+    Context* sleeper = nullptr;
+    auto start = Clock::now();
+
+    // sleep is not shortened, the interrupt stays pending
+    d.spawn([&] {
+        sleeper = Context::self();
+        Context::sleep_for(ms30);
+        EXPECT_NEAR(30, elapsed(start), 10);
+        EXPECT_TRUE(Context::clearInterrupt());
+    });
+
+    d.spawn([&] {
+        Context::sleep_for(std::chrono::milliseconds(5));
+        sleeper->interrupt();
+    });
+
+    d.dispatch();
+}
+
 TEST(Event, notifyOne)
 {
     Dispatcher d;
@@ -242,6 +428,371 @@ TEST(Event, invertedOrder)
     d.dispatch();
 
     ASSERT_EQ(waiters, received);
-}    
+}
 
+TEST(Event, notifyReadyWaiter)
+{
+    Dispatcher d;
+    Event e;
+    Context* waiter = nullptr;
+    bool kicked = false;
+    bool done = false;
 
+    // notifier runs right before the waiter in the same pass, the waiter
+    // is switched to directly and finishes there, the pass must go on
+    // without it (a timed wait expiring with its notifier does the same)
+    d.spawn([&] {
+        while (!kicked) {
+            Context::yield();
+        }
+        e.notify_one();
+    });
+
+    d.spawn([&] {
+        waiter = Context::self();
+        e.wait();
+        done = true;
+    });
+
+    d.spawn([&] {
+        // spurious wake puts the waiter behind the notifier
+        waiter->enable();
+        kicked = true;
+    });
+
+    d.dispatch();
+    EXPECT_TRUE(done);
+}
+
+TEST(Event, waitForTimeout)
+{
+    Dispatcher d;
+    Event e;
+    bool woken = false;
+
+    d.spawn([&] {
+        // timed out waiter must not stay in the queue
+        EXPECT_FALSE(e.wait_for(std::chrono::milliseconds(5)));
+    });
+
+    d.spawn([&] {
+        Context::sleep_for(std::chrono::milliseconds(1));
+        EXPECT_TRUE(e.wait_for(std::chrono::milliseconds(100)));
+        woken = true;
+    });
+
+    d.spawn([&] {
+        Context::sleep_for(std::chrono::milliseconds(20));
+        e.notify_one();
+    });
+
+    d.dispatch();
+    EXPECT_TRUE(woken);
+}
+
+TEST(Channel, unbuffered)
+{
+    Dispatcher d;
+    Channel<std::unique_ptr<int>> ch;
+    std::vector<int> received;
+
+    d.spawn([&] {
+        std::unique_ptr<int> v;
+        while (ch.recv(v)) {
+            received.push_back(*v);
+        }
+    });
+
+    d.spawn([&] {
+        for (int i = 0; i < 5; ++i) {
+            EXPECT_TRUE(ch.send(std::unique_ptr<int>(new int(i))));
+            // no buffering, receiver has taken the value already
+            EXPECT_EQ(0u, ch.size());
+        }
+        ch.close();
+        EXPECT_FALSE(ch.send(std::unique_ptr<int>(new int(5))));
+    });
+
+    d.dispatch();
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4}), received);
+}
+
+TEST(Channel, buffered)
+{
+    Dispatcher d;
+    Channel<int> ch(3);
+    std::vector<int> received;
+
+    d.spawn([&] {
+        // fills buffer, then blocks on the fourth value
+        for (int i = 0; i < 10; ++i) {
+            EXPECT_TRUE(ch.send(i));
+            EXPECT_LE(ch.size(), 3u);
+        }
+        ch.close();
+    });
+
+    d.spawn([&] {
+        EXPECT_EQ(3u, ch.size());
+        int v;
+        while (ch.recv(v)) {
+            received.push_back(v);
+        }
+        EXPECT_TRUE(ch.closed());
+    });
+
+    d.dispatch();
+    EXPECT_EQ(10u, received.size());
+    EXPECT_TRUE(std::is_sorted(received.begin(), received.end()));
+}
+
+TEST(Channel, select)
+{
+    Dispatcher d;
+    Channel<int> a;
+    Channel<std::string> b;
+    Channel<int> out(1);
+    int gotA = 0;
+    int gotB = 0;
+
+    d.spawn([&] {
+        int va;
+        std::string vb;
+        bool ok = true;
+        while (gotA + gotB < 4) {
+            int r = select(a.recvCase(va), b.recvCase(vb, &ok));
+            ASSERT_TRUE(ok);
+            if (r == 0) {
+                EXPECT_EQ(42, va);
+                ++gotA;
+            } else {
+                ASSERT_EQ(1, r);
+                EXPECT_EQ("hello", vb);
+                ++gotB;
+            }
+        }
+
+        // buffer has space, so send case completes at once
+        int v = 7;
+        EXPECT_EQ(1, select(a.recvCase(va), out.sendCase(v)));
+        EXPECT_EQ(1u, out.size());
+    });
+
+    d.spawn([&] {
+        a.send(42);
+        b.send("hello");
+        b.send("hello");
+        a.send(42);
+    });
+
+    d.dispatch();
+    EXPECT_EQ(2, gotA);
+    EXPECT_EQ(2, gotB);
+}
+
+TEST(Channel, selectTimeout)
+{
+    Dispatcher d;
+    Channel<int> a;
+    Channel<int> b;
+
+    d.spawn([&] {
+        int v;
+        auto start = Clock::now();
+        EXPECT_EQ(-1, select_for(std::chrono::milliseconds(20), a.recvCase(v), b.recvCase(v)));
+        EXPECT_GE(Clock::now() - start, std::chrono::milliseconds(20));
+
+        // timed out waiters are removed, stale ones would take the value
+        EXPECT_EQ(0, select_for(std::chrono::milliseconds(100), a.recvCase(v)));
+        EXPECT_EQ(5, v);
+
+        bool ok = true;
+        b.close();
+        EXPECT_EQ(0, select_for(std::chrono::milliseconds(0), b.recvCase(v, &ok)));
+        EXPECT_FALSE(ok);
+    });
+
+    d.spawn([&] {
+        Context::sleep_for(std::chrono::milliseconds(40));
+        a.send(5);
+    });
+
+    d.dispatch();
+}
+
+TEST(Remote, wakeFromAnyThread)
+{
+    Dispatcher d;
+    std::atomic<Context*> waiter{nullptr};
+    std::thread waker;
+    bool woken = false;
+
+    d.spawn([&] {
+        waker = std::thread([&] {
+            while (waiter.load() == nullptr)
+                std::this_thread::yield();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            waiter.load()->wakeFromAnyThread();
+        });
+
+        auto self = Context::self();
+        self->disable();
+        waiter = self;
+        Context::yield();
+        woken = true;
+    });
+
+    d.dispatch();
+    waker.join();
+
+    EXPECT_TRUE(woken);
+}
+
+TEST(Remote, post)
+{
+    Dispatcher d;
+    const int threads = 4;
+    const int posts = 1000;
+    int executed = 0;
+    std::vector<std::thread> producers;
+
+    d.spawn([&] {
+        for (int i = 0; i < threads; ++i) {
+            producers.emplace_back([&] {
+                for (int j = 0; j < posts; ++j) {
+                    d.post([&] { ++executed; });
+                }
+            });
+        }
+
+        // keep dispatcher busy until all posted functions ran
+        while (executed != threads * posts) {
+            Context::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    d.dispatch();
+
+    for (auto& t : producers) {
+        t.join();
+    }
+
+    EXPECT_EQ(threads * posts, executed);
+}
+
+
+TEST(Dispatcher, stats)
+{
+    Dispatcher d;
+    std::atomic<bool> done{false};
+
+    // readable from other threads while the dispatcher runs
+    std::thread reader([&] {
+        while (!done.load()) {
+            DispatcherStats st = d.stats();
+            EXPECT_LE(st.finished, st.spawns);
+            std::this_thread::yield();
+        }
+    });
+
+    for (int i = 0; i < 3; ++i) {
+        d.spawn([] {
+            Context::yield();
+            Context::sleep_for(std::chrono::milliseconds(10));
+        });
+    }
+
+    d.dispatch();
+    done.store(true);
+    reader.join();
+
+    DispatcherStats st = d.stats();
+    EXPECT_EQ(3u, st.spawns);
+    EXPECT_EQ(3u, st.finished);
+    EXPECT_GE(st.switches, 9u);
+    EXPECT_EQ(0u, st.ready);
+    EXPECT_EQ(0u, st.sleeping);
+    EXPECT_EQ(0u, st.disabled);
+    EXPECT_EQ(3u, st.unused);
+
+    // the sleep is spent in the poller
+    EXPECT_GE(st.polls, 1u);
+    EXPECT_GE(st.blockedNs, 5000000u);
+
+    uint64_t loops = 0;
+    for (uint64_t n : st.loops) {
+        loops += n;
+    }
+    EXPECT_GE(loops, st.polls);
+}
+
+TEST(Histogram, percentiles)
+{
+    LatencyHistogram h;
+    EXPECT_EQ(0, h.percentile(0.5));
+
+    for (int64_t v = 1; v <= 100000; ++v) {
+        h.record(v);
+    }
+
+    EXPECT_EQ(100000u, h.count());
+    EXPECT_EQ(100000, h.max());
+    // buckets are 1/16 of a power of two wide
+    EXPECT_NEAR(50000, h.percentile(0.5), 50000 / 16);
+    EXPECT_NEAR(99000, h.percentile(0.99), 99000 / 16);
+    EXPECT_NEAR(99900, h.percentile(0.999), 99900 / 16);
+    EXPECT_EQ(100000, h.percentile(1.0));
+
+    // small values are exact
+    LatencyHistogram small;
+    small.record(3);
+    small.record(-5);
+    EXPECT_EQ(0, small.percentile(0.5));
+    EXPECT_EQ(3, small.percentile(1.0));
+
+    h.merge(small);
+    EXPECT_EQ(100002u, h.count());
+    h.reset();
+    EXPECT_EQ(0u, h.count());
+}
+
+TEST(Dispatcher, wakeLatency)
+{
+    for (bool track : {false, true}) {
+        Dispatcher d;
+        d.trackLatency(track);
+
+        // a busy context delays the wakeups of the sleeper
+        d.spawn([] {
+            for (int i = 0; i < 20; ++i) {
+                auto until = Clock::now() + std::chrono::milliseconds(1);
+                while (Clock::now() < until) {
+                }
+                Context::yield();
+            }
+        });
+
+        d.spawn([] {
+            Context::self()->setLatencyTag("sleeper");
+            for (int i = 0; i < 5; ++i) {
+                Context::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+
+        d.dispatch();
+
+        const LatencyHistogram* sleeper = d.latency("sleeper");
+        ASSERT_NE(nullptr, sleeper);
+
+        if (!track) {
+            EXPECT_EQ(0u, d.latency().count());
+            EXPECT_EQ(0u, sleeper->count());
+            continue;
+        }
+
+        EXPECT_EQ(5u, sleeper->count());
+        EXPECT_GE(d.latency().count(), sleeper->count());
+        EXPECT_GE(sleeper->percentile(0.5), 500000);
+        EXPECT_EQ(nullptr, d.latency("unknown"));
+    }
+}
@@ -0,0 +1,28 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Kept apart from the code using new, inlining the replaced operator
+// delete there trips -Wmismatched-new-delete.
+
+std::atomic<bool> g_counting{false};
+std::atomic<std::size_t> g_allocations{0};
+
+void* operator new(std::size_t sz)
+{
+    if (g_counting.load(std::memory_order_relaxed))
+        ++g_allocations;
+    if (void* p = malloc(sz ? sz : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    free(p);
+}
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#include <iofile.h>
+#include <iouring.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using namespace iocoro;
+
+namespace {
+
+class FileTest: public testing::TestWithParam<bool>
+{
+protected:
+    std::string path;
+
+    virtual void SetUp() override
+    {
+        char name[] = "/tmp/iocoro_fileXXXXXX";
+        int fd = mkstemp(name);
+        ASSERT_NE(-1, fd);
+        ::close(fd);
+        path = name;
+    }
+
+    virtual void TearDown() override
+    {
+        unlink(path.c_str());
+    }
+
+    // true if the test runs in the requested mode
+    bool setup(Dispatcher& d)
+    {
+        return !GetParam() || d.useIoUring();
+    }
+};
+
+}
+
+TEST_P(FileTest, writeAndRead)
+{
+    Dispatcher d;
+    if (!setup(d))
+        return;
+
+    d.spawn([&] {
+        AsyncFile f;
+        ASSERT_EQ(0, f.open(path.c_str(), O_RDWR));
+
+        const char data[] = "0123456789";
+        ASSERT_EQ(10, f.pwrite(data, 10, 0));
+        ASSERT_EQ(10, f.pwrite(data, 10, 10));
+        ASSERT_EQ(0, f.fsync());
+        ASSERT_EQ(0, f.fsync(true));
+
+        char buf[8];
+        ASSERT_EQ(8, f.pread(buf, sizeof(buf), 8));
+        EXPECT_EQ(0, memcmp("89012345", buf, 8));
+
+        // short read at the end
+        EXPECT_EQ(2, f.pread(buf, sizeof(buf), 18));
+        EXPECT_EQ(0, f.pread(buf, sizeof(buf), 20));
+    });
+
+    d.dispatch();
+}
+
+TEST_P(FileTest, errors)
+{
+    Dispatcher d;
+    if (!setup(d))
+        return;
+
+    d.spawn([&] {
+        AsyncFile f;
+        EXPECT_EQ(ENOENT, f.open("/nonexistent/file", O_RDONLY));
+
+        ASSERT_EQ(0, f.open(path.c_str(), O_RDONLY));
+        char buf[4] = {};
+        EXPECT_EQ(-1, f.pwrite(buf, sizeof(buf), 0));
+        EXPECT_EQ(EBADF, errno);
+    });
+
+    d.dispatch();
+}
+
+TEST_P(FileTest, concurrentReads)
+{
+    const int readers = 32;
+    const std::size_t block = 4096;
+
+    {
+        std::vector<char> data(readers * block);
+        for (std::size_t i = 0; i < data.size(); ++i) {
+            data[i] = char(i / block);
+        }
+        FILE* fp = fopen(path.c_str(), "wb");
+        ASSERT_EQ(data.size(), fwrite(data.data(), 1, data.size(), fp));
+        fclose(fp);
+    }
+
+    Dispatcher d;
+    if (!setup(d))
+        return;
+
+    AsyncFile f;
+    int done = 0;
+
+    d.spawn([&] {
+        ASSERT_EQ(0, f.open(path.c_str(), O_RDONLY));
+
+        // all reads are in flight at once
+        for (int i = 0; i < readers; ++i) {
+            d.spawn([&, i] {
+                std::vector<char> buf(block);
+                ASSERT_EQ(ssize_t(block), f.pread(buf.data(), block, i * block));
+                EXPECT_EQ(char(i), buf[0]);
+                EXPECT_EQ(char(i), buf[block - 1]);
+                ++done;
+            });
+        }
+    });
+
+    d.dispatch();
+    EXPECT_EQ(readers, done);
+}
+
+TEST_P(FileTest, ringCreatedOnFirstUse)
+{
+    Dispatcher d;
+    if (!setup(d))
+        return;
+
+    // the thread pool is only the fallback without io_uring support
+    bool supported = IoUring::create(8, false) != nullptr;
+
+    d.spawn([&] {
+        AsyncFile f;
+        ASSERT_EQ(0, f.open(path.c_str(), O_RDWR));
+        ASSERT_EQ(1, f.pwrite("x", 1, 0));
+
+        IoUring* ring = d.getFileRing();
+        EXPECT_EQ(supported, ring != nullptr);
+        // sockets stay on the poller unless useIoUring() was called
+        if (d.getIoUring() != nullptr) {
+            EXPECT_EQ(d.getIoUring(), ring);
+        }
+    });
+
+    d.dispatch();
+}
+
+INSTANTIATE_TEST_SUITE_P(AsyncFile, FileTest, testing::Values(false, true));
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include <iooffload.h>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using namespace iocoro;
+
+TEST(Offload, returnsValue)
+{
+    Dispatcher d;
+
+    d.spawn([&] {
+        auto caller = std::this_thread::get_id();
+        std::thread::id worker = offload([] { return std::this_thread::get_id(); });
+        EXPECT_NE(caller, worker);
+
+        std::unique_ptr<std::string> s = offload([] {
+            return std::unique_ptr<std::string>(new std::string("moved"));
+        });
+        EXPECT_EQ("moved", *s);
+
+        int calls = 0;
+        offload([&] { ++calls; });
+        EXPECT_EQ(1, calls);
+    });
+
+    d.dispatch();
+}
+
+TEST(Offload, rethrows)
+{
+    Dispatcher d;
+    bool caught = false;
+
+    d.spawn([&] {
+        try {
+            offload([]() -> int { throw std::runtime_error("blocking call failed"); });
+        } catch (const std::runtime_error& e) {
+            EXPECT_STREQ("blocking call failed", e.what());
+            caught = true;
+        }
+    });
+
+    d.dispatch();
+    EXPECT_TRUE(caught);
+}
+
+TEST(Offload, dispatcherKeepsRunning)
+{
+    Dispatcher d;
+    OffloadPool pool(2);
+    int ticks = 0;
+    int finished = 0;
+
+    for (int i = 0; i < 2; ++i) {
+        d.spawn([&] {
+            pool.run([] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            });
+            ++finished;
+        });
+    }
+
+    d.spawn([&] {
+        while (finished < 2) {
+            Context::sleep_for(std::chrono::milliseconds(1));
+            ++ticks;
+        }
+    });
+
+    d.dispatch();
+    EXPECT_EQ(2, finished);
+    // would be 1 if blocking calls stalled the dispatcher
+    EXPECT_GT(ticks, 10);
+}
+
+TEST(Offload, sleepAfterRun)
+{
+    Dispatcher d;
+    int early = 0;
+
+    d.spawn([&] {
+        for (int i = 0; i < 200; ++i) {
+            EXPECT_EQ(1, offload([] { return 1; }));
+
+            // a wakeup of the finished job must not cut the sleep short
+            auto start = Clock::now();
+            Context::sleep_for(std::chrono::microseconds(500));
+            if (Clock::now() - start < std::chrono::microseconds(500))
+                ++early;
+        }
+    });
+
+    d.dispatch();
+    EXPECT_EQ(0, early);
+}
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include <ioruntime.h>
+#include <iosocket.h>
+
+#include <atomic>
+#include <thread>
+
+using namespace iocoro;
+
+TEST(Runtime, runsAllTasks)
+{
+    std::atomic<int> done{0};
+    const int tasks = 1000;
+
+    Runtime rt(4);
+    for (int i = 0; i < tasks; ++i) {
+        rt.spawn([&] {
+            Context::yield();
+            ++done;
+        });
+    }
+    rt.join();
+
+    EXPECT_EQ(tasks, done.load());
+}
+
+TEST(Runtime, nestedSpawn)
+{
+    std::atomic<int> done{0};
+    const int outer = 20;
+    const int inner = 50;
+
+    Runtime rt(3);
+    for (int i = 0; i < outer; ++i) {
+        rt.spawn([&] {
+            EXPECT_EQ(&rt, Runtime::current());
+            for (int j = 0; j < inner; ++j) {
+                rt.spawn([&] { ++done; });
+            }
+        });
+    }
+    rt.join();
+
+    EXPECT_EQ(outer * inner, done.load());
+}
+
+TEST(Runtime, spawnFromManyThreads)
+{
+    std::atomic<int> done{0};
+    const int threads = 4;
+    const int tasks = 250;
+
+    Runtime rt(2);
+    std::vector<std::thread> producers;
+    for (int i = 0; i < threads; ++i) {
+        producers.emplace_back([&] {
+            for (int j = 0; j < tasks; ++j) {
+                rt.spawn([&] { ++done; });
+            }
+        });
+    }
+
+    for (auto& t : producers) {
+        t.join();
+    }
+    rt.join();
+
+    EXPECT_EQ(threads * tasks, done.load());
+    EXPECT_EQ(nullptr, Runtime::current());
+}
+
+TEST(Runtime, sleepingTasks)
+{
+    std::atomic<int> done{0};
+
+    Runtime rt(2);
+    for (int i = 0; i < 10; ++i) {
+        rt.spawn([&] {
+            Context::sleep_for(std::chrono::milliseconds(10));
+            ++done;
+        });
+    }
+    rt.join();
+
+    EXPECT_EQ(10, done.load());
+}
+
+TEST(Runtime, startedTasksStayOnWorker)
+{
+    std::atomic<int> moved{0};
+
+    Runtime rt(4);
+    for (int i = 0; i < 32; ++i) {
+        rt.spawn([&] {
+            std::thread::id started = std::this_thread::get_id();
+            for (int j = 0; j < 10; ++j) {
+                Context::yield();
+                Context::sleep_for(std::chrono::milliseconds(1));
+                if (std::this_thread::get_id() != started)
+                    ++moved;
+            }
+        });
+    }
+    rt.join();
+
+    EXPECT_EQ(0, moved.load());
+}
+
+TEST(Runtime, socketsStayOnWorker)
+{
+    std::atomic<int> served{0};
+    const int clients = 8;
+    const uint16_t port = 8097;
+
+    Runtime rt(2);
+    rt.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(128));
+
+        for (int i = 0; i < clients; ++i) {
+            rt.spawn([&] {
+                Connection c;
+                ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+                c.writeAll("ping", 4);
+                char buf[4];
+                ASSERT_EQ(4, c.read(buf, sizeof(buf)));
+            });
+        }
+
+        for (int i = 0; i < clients; ++i) {
+            Connection conn;
+            ASSERT_TRUE(listener.accept(conn));
+            char buf[4];
+            ASSERT_EQ(4, conn.read(buf, sizeof(buf)));
+            conn.writeAll(buf, 4);
+            ++served;
+        }
+    });
+    rt.join();
+
+    EXPECT_EQ(clients, served.load());
+}
@@ -1,6 +1,20 @@
 #include <gtest/gtest.h>
 #include <iosocket.h>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
 #include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
 
 namespace iocoro
 {
@@ -51,5 +65,1039 @@ TEST_F(SocketTest, connect)
     d.dispatch();
 }
 
+TEST(Socket, scatterGather)
+{
+    const uint16_t port = 8098;
+    // big enough to get partial writes
+    const std::size_t payloadSize = 8 * 1024 * 1024;
+    Dispatcher d;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+
+        char header[8];
+        std::vector<char> payload(payloadSize);
+        IoVec bufs[] = {{header, sizeof(header)}, {payload.data(), payload.size()}};
+        ASSERT_EQ(sizeof(header) + payloadSize, conn.readAll(bufs, 2));
+
+        EXPECT_EQ(0, memcmp("HEADER01", header, sizeof(header)));
+        for (std::size_t i = 0; i < payloadSize; i += 4096) {
+            ASSERT_EQ(char(i / 4096), payload[i]);
+        }
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+
+        char header[] = "HEADER01";
+        std::vector<char> payload(payloadSize);
+        for (std::size_t i = 0; i < payloadSize; i += 4096) {
+            payload[i] = char(i / 4096);
+        }
+
+        // empty buffers are skipped
+        IoVec bufs[] = {{header, 0}, {header, 8}, {nullptr, 0}, {payload.data(), payload.size()}};
+        ASSERT_EQ(8 + payloadSize, c.writeAll(bufs, 4));
+    });
+
+    d.dispatch();
+}
+
+TEST(Socket, ioUring)
+{
+    const uint16_t port = 8096;
+    Dispatcher d;
+    if (!d.useIoUring(64, true)) {
+        // kernel without io_uring
+        return;
+    }
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+
+        char buf[64];
+        int r = conn.read(buf, sizeof(buf));
+        ASSERT_EQ(5, r);
+        EXPECT_EQ(0, memcmp("hello", buf, 5));
+        ASSERT_EQ(5, conn.writeAll("world", 5));
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+        ASSERT_EQ(5, c.writeAll("hello", 5));
+
+        char buf[5];
+        IoVec bufs[] = {{buf, 2}, {buf + 2, 3}};
+        ASSERT_EQ(5, c.readAll(bufs, 2));
+        EXPECT_EQ(0, memcmp("world", buf, 5));
+    });
+
+    d.dispatch();
+}
+
+TEST(Socket, acceptMany)
+{
+    const uint16_t port = 8095;
+    const int clients = 10;
+    Dispatcher d;
+    int served = 0;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        // let all clients queue up in the backlog
+        for (int i = 0; i < clients; ++i) {
+            d.spawn([&] {
+                Connection c;
+                ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+                char b;
+                EXPECT_EQ(1, c.read(&b, 1));
+            });
+        }
+        Context::sleep_for(std::chrono::milliseconds(20));
+
+        IncomingConnection in[clients];
+        std::size_t n = listener.acceptMany(in, clients);
+        EXPECT_EQ(std::size_t(clients), n);
+
+        for (std::size_t i = 0; i < n; ++i) {
+            int fd = in[i].handle;
+            EXPECT_NE(0, fcntl(fd, F_GETFL) & O_NONBLOCK);
+            EXPECT_NE(0, fcntl(fd, F_GETFD) & FD_CLOEXEC);
+
+            int nodelay = 0;
+            socklen_t len = sizeof(nodelay);
+            getsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, &len);
+            EXPECT_NE(0, nodelay);
+
+            Connection conn(in[i].handle.release());
+            EXPECT_EQ(1, conn.writeAll("x", 1));
+            ++served;
+        }
+    });
+
+    d.dispatch();
+    EXPECT_EQ(clients, served);
+}
+
+TEST(Socket, serve)
+{
+    const uint16_t port = 8094;
+    const int clients = 20;
+    Dispatcher d;
+    int replies = 0;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(64));
+
+        for (int i = 0; i < clients; ++i) {
+            d.spawn([&] {
+                Connection c;
+                ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+                char b;
+                ASSERT_EQ(1, c.read(&b, 1));
+                if (++replies == clients) {
+                    listener.shutdown();
+                }
+            });
+        }
+
+        EXPECT_NE(0, listener.serve([](Connection& conn) {
+            conn.writeAll("x", 1);
+        }));
+    });
+
+    d.dispatch();
+    EXPECT_EQ(clients, replies);
+}
+
+TEST(Socket, sendFile)
+{
+    const uint16_t port = 8093;
+    const std::size_t size = 4 * 1024 * 1024 + 123;
+
+    char name[] = "/tmp/iocoro_sendfileXXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_NE(-1, fd);
+    unlink(name);
+    FileHandle file(fd);
+
+    std::vector<char> data(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        data[i] = char(i * 7);
+    }
+    ASSERT_EQ(ssize_t(size), ::write(fd, data.data(), size));
+
+    Dispatcher d;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+        // file ends before len
+        EXPECT_EQ(int64_t(size - 100), conn.sendFile(file, 100, size));
+        conn.shutdown();
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+
+        std::vector<char> received(size - 100);
+        IoVec buf{received.data(), received.size()};
+        ASSERT_EQ(int(received.size()), c.readAll(&buf, 1));
+        EXPECT_TRUE(std::equal(received.begin(), received.end(), data.begin() + 100));
+    });
+
+    d.dispatch();
+}
+
+TEST(Socket, splice)
+{
+    const uint16_t port = 8092;
+    const std::size_t size = 2 * 1024 * 1024;
+    Dispatcher d;
+    std::vector<char> data(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        data[i] = char(i * 13);
+    }
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        // proxy: first connection is the source, second one the sink
+        Connection src;
+        Connection dst;
+        ASSERT_TRUE(listener.accept(src));
+        ASSERT_TRUE(listener.accept(dst));
+
+        EXPECT_EQ(int64_t(size), src.spliceTo(dst, size * 2));
+        dst.shutdown();
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+        ASSERT_EQ(int(size), c.writeAll(data.data(), size));
+        c.shutdown();
+    });
+
+    d.spawn([&] {
+        Context::sleep_for(std::chrono::milliseconds(5));
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+
+        std::vector<char> received(size);
+        IoVec buf{received.data(), received.size()};
+        ASSERT_EQ(int(size), c.readAll(&buf, 1));
+        EXPECT_EQ(data, received);
+    });
+
+    d.dispatch();
+}
+
+TEST(Socket, zeroCopy)
+{
+    const uint16_t port = 8089;
+    const std::size_t size = 1024 * 1024;
+    Dispatcher d;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+
+        std::vector<char> received(size * 3);
+        IoVec buf{received.data(), received.size()};
+        ASSERT_EQ(int(received.size()), conn.readAll(&buf, 1));
+        for (std::size_t i = 0; i < received.size(); i += 4096) {
+            ASSERT_EQ(char(i / size), received[i]);
+        }
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+        if (c.setZeroCopy(true, 64 * 1024) != 0) {
+            // kernel without SO_ZEROCOPY, still drain the server
+            std::vector<char> data(size * 3);
+            for (std::size_t i = 0; i < data.size(); ++i) {
+                data[i] = char(i / size);
+            }
+            c.writeAll(data.data(), data.size());
+            return;
+        }
+
+        std::vector<char> data(size, 0);
+        // returns with the buffer released, so it can be changed right away
+        ASSERT_EQ(int(size), c.writeAll(data.data(), size));
+        std::fill(data.begin(), data.end(), 1);
+
+        ASSERT_EQ(int(size), c.sendZeroCopy(data.data(), size));
+        ASSERT_EQ(0, c.waitZeroCopy());
+        std::fill(data.begin(), data.end(), 2);
+        ASSERT_EQ(int(size), c.writeAll(data.data(), size));
+    });
+
+    d.dispatch();
+}
+
+
+TEST(Socket, buffered)
+{
+    const uint16_t port = 8087;
+    const int lines = 1000;
+    Dispatcher d;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+        BufferedConnection in(conn);
+
+        const char* line = nullptr;
+        for (int i = 0; i < lines; ++i) {
+            std::string expected = "line " + std::to_string(i) + "\n";
+            ASSERT_EQ(int(expected.size()), in.readUntil('\n', line));
+            ASSERT_EQ(expected, std::string(line, expected.size()));
+        }
+
+        char header[4];
+        ASSERT_EQ(4, in.readExactly(header, 4));
+        ASSERT_EQ("HEAD", std::string(header, 4));
+
+        const char* data = nullptr;
+        ASSERT_GT(in.peek(data), 0);
+        ASSERT_EQ('x', data[0]);
+
+        // no delimiter within one buffer
+        ASSERT_EQ(-1, in.readUntil('\n', line));
+        ASSERT_EQ(EMSGSIZE, errno);
+
+        std::vector<char> big(64 * 1024);
+        ASSERT_EQ(int(big.size()), in.readExactly(big.data(), big.size()));
+        ASSERT_EQ(std::vector<char>(big.size(), 'x'), big);
+        ASSERT_EQ(0, in.readUntil('\n', line));
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+        {
+            BufferedConnection out(c);
+            for (int i = 0; i < lines; ++i) {
+                std::string s = "line " + std::to_string(i) + "\n";
+                ASSERT_EQ(int(s.size()), out.write(s.data(), s.size()));
+            }
+            out.write("HEAD", 4);
+
+            // larger than the buffer, goes out together with buffered data
+            std::vector<char> big(64 * 1024, 'x');
+            ASSERT_EQ(int(big.size()), out.write(big.data(), big.size()));
+            ASSERT_EQ(0, out.flush());
+        }
+        c.shutdown();
+    });
+
+    d.dispatch();
+    EXPECT_EQ(0u, d.getBufferPool().inUse());
+}
+
+
+TEST(Socket, corked)
+{
+    const uint16_t port = 8085;
+    const int messages = 100;
+    const std::string message = "0123456789abcdef";
+    Dispatcher d;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+        conn.setCorked(true);
+        for (int i = 0; i < messages; ++i) {
+            ASSERT_EQ(int(message.size()), conn.writeAll(message.data(), message.size()));
+        }
+
+        // nothing is sent before this context yields
+        char c;
+        ASSERT_EQ(1, conn.read(&c, 1));
+
+        // larger than the limit goes out right after the buffered data
+        std::vector<char> big(Connection::CORK_LIMIT + 1, 'x');
+        ASSERT_EQ(int(big.size()), conn.writeAll(big.data(), big.size()));
+        ASSERT_EQ(int(message.size()), conn.writeAll(message.data(), message.size()));
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+
+        // all messages arrive with a single write
+        std::vector<char> buf(messages * message.size() * 2);
+        ASSERT_EQ(int(messages * message.size()), c.read(buf.data(), buf.size()));
+        ASSERT_EQ(message, std::string(buf.data(), message.size()));
+        ASSERT_EQ(1, c.writeAll("x", 1));
+
+        std::vector<char> rest(Connection::CORK_LIMIT + 1 + message.size());
+        IoVec v{rest.data(), rest.size()};
+        ASSERT_EQ(int(rest.size()), c.readAll(&v, 1));
+        ASSERT_EQ(message, std::string(rest.end() - message.size(), rest.end()));
+    });
+
+    d.dispatch();
+}
+
+
+TEST(Socket, datagram)
+{
+    const uint16_t port = 8083;
+    const int count = 50;
+    Dispatcher d;
+
+    d.spawn([&] {
+        DatagramSocket server;
+        ASSERT_EQ(0, server.bind(IP4Endpoint(IP4Address::loopback(), port)));
+
+        char buf[2048];
+        IP4Endpoint from;
+        ASSERT_EQ(5, server.recvFrom(buf, sizeof(buf), &from));
+        ASSERT_EQ("hello", std::string(buf, 5));
+        ASSERT_EQ(5, server.sendTo("world", 5, from));
+
+        std::vector<std::vector<char>> storage(count, std::vector<char>(64));
+        std::vector<Datagram> msgs(count);
+        for (int i = 0; i < count; ++i) {
+            msgs[i].buf = IoVec{storage[i].data(), storage[i].size()};
+        }
+
+        int received = 0;
+        while (received < count) {
+            int r = server.recvMany(msgs.data() + received, count - received);
+            ASSERT_GT(r, 0);
+            received += r;
+        }
+        for (int i = 0; i < count; ++i) {
+            ASSERT_EQ(std::size_t(4), msgs[i].size);
+            ASSERT_EQ(i, *reinterpret_cast<int*>(storage[i].data()));
+            ASSERT_EQ(from, msgs[i].endpoint);
+        }
+
+        // segmented send arrives as separate datagrams
+        int segments = 0;
+        while (segments < 4) {
+            int r = server.recvFrom(buf, sizeof(buf));
+            if (r == 1 && buf[0] == 'x')
+                break;
+            ASSERT_EQ(1000, r);
+            ++segments;
+        }
+    });
+
+    d.spawn([&] {
+        DatagramSocket client;
+        ASSERT_EQ(0, client.connect(IP4Endpoint(IP4Address::loopback(), port)));
+        ASSERT_EQ(5, client.send("hello", 5));
+
+        char buf[16];
+        IP4Endpoint from;
+        ASSERT_EQ(5, client.recvFrom(buf, sizeof(buf), &from));
+        ASSERT_EQ(IP4Endpoint(IP4Address::loopback(), port), from);
+
+        ASSERT_EQ(-1, client.recvFrom(buf, sizeof(buf), nullptr,
+                Clock::now() + std::chrono::milliseconds(10)));
+        ASSERT_EQ(ETIMEDOUT, errno);
+
+        std::vector<int> values(count);
+        std::vector<Datagram> msgs(count);
+        for (int i = 0; i < count; ++i) {
+            values[i] = i;
+            msgs[i].buf = IoVec{reinterpret_cast<char*>(&values[i]), sizeof(int)};
+        }
+        ASSERT_EQ(count, client.sendMany(msgs.data(), msgs.size()));
+
+        if (client.setSegmentSize(1000) != 0) {
+            // kernel without UDP_SEGMENT
+            client.send("x", 1);
+            return;
+        }
+        std::vector<char> big(4000, 'y');
+        ASSERT_EQ(4000, client.send(big.data(), big.size()));
+    });
+
+    d.dispatch();
+}
+
+
+TEST(Socket, endpoint)
+{
+    Endpoint ep4(IP4Endpoint(IP4Address::loopback(), 80));
+    EXPECT_EQ(AF_INET, ep4.family());
+    EXPECT_EQ(80, ep4.port());
+    EXPECT_EQ(IP4Endpoint(IP4Address::loopback(), 80), ep4.ip4());
+
+    Endpoint ep6 = Endpoint::ip6("::1", 443);
+    EXPECT_EQ(AF_INET6, ep6.family());
+    EXPECT_EQ(443, ep6.port());
+    EXPECT_EQ(ep6, Endpoint::ip6("0:0::1", 443));
+    EXPECT_EQ(AF_UNSPEC, Endpoint::ip6("not an address", 1).family());
+
+    Endpoint local = Endpoint::local("/tmp/x.sock");
+    EXPECT_EQ(AF_UNIX, local.family());
+    EXPECT_EQ("/tmp/x.sock", local.path());
+    EXPECT_EQ(std::string("\0abstract", 9), Endpoint::local(std::string("\0abstract", 9)).path());
+    EXPECT_EQ(AF_UNSPEC, Endpoint::local(std::string(200, 'x')).family());
+}
+
+TEST(Socket, unixDomain)
+{
+    const std::string path = "/tmp/iocoro_test_" + std::to_string(getpid()) + ".sock";
+    unlink(path.c_str());
+    Dispatcher d;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(Endpoint::local(path)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+        EXPECT_EQ(AF_UNIX, conn.remoteAddress().family());
+
+        char buf[16];
+        FileHandle fds[2];
+        std::size_t count = 0;
+        ASSERT_EQ(4, conn.recvFds(buf, sizeof(buf), fds, 2, count));
+        ASSERT_EQ("pipe", std::string(buf, 4));
+        ASSERT_EQ(1u, count);
+
+        // read end of the pipe created by the client
+        ASSERT_EQ(5, ::read(fds[0], buf, sizeof(buf)));
+        ASSERT_EQ("hello", std::string(buf, 5));
+
+        ASSERT_EQ(5, conn.writeAll("world", 5));
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(Endpoint::local(path)));
+        EXPECT_EQ(Endpoint::local(path), c.remoteAddress());
+
+        int p[2];
+        ASSERT_EQ(0, pipe(p));
+        FileHandle r(p[0]);
+        FileHandle w(p[1]);
+        ASSERT_EQ(5, ::write(w, "hello", 5));
+        ASSERT_EQ(4, c.sendFds("pipe", 4, &p[0], 1));
+
+        char buf[16];
+        ASSERT_EQ(5, c.read(buf, sizeof(buf)));
+        ASSERT_EQ("world", std::string(buf, 5));
+    });
+
+    d.dispatch();
+    unlink(path.c_str());
+}
+
+TEST(Socket, ip6)
+{
+    const uint16_t port = 8081;
+    Dispatcher d;
+
+    d.spawn([&] {
+        Listener listener;
+        int r = listener.bind(Endpoint::ip6("::1", port));
+        if (r == EADDRNOTAVAIL || r == EAFNOSUPPORT) {
+            std::cout << "IPv6 loopback not available" << std::endl;
+            return;
+        }
+        ASSERT_EQ(0, r);
+        ASSERT_EQ(0, listener.listen(16));
+
+        d.spawn([&] {
+            Connection c;
+            ASSERT_EQ(0, c.connect(Endpoint::ip6("::1", port)));
+            ASSERT_EQ(5, c.writeAll("hello", 5));
+        });
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+        EXPECT_EQ(AF_INET6, conn.remoteAddress().family());
+
+        char buf[16];
+        ASSERT_EQ(5, conn.read(buf, sizeof(buf)));
+        ASSERT_EQ("hello", std::string(buf, 5));
+    });
+
+    d.dispatch();
+}
+
+
+TEST(Socket, deadlineAndInterrupt)
+{
+    const uint16_t port = 8080;
+
+    for (bool ring : {false, true}) {
+        Dispatcher d;
+        if (ring && !d.useIoUring())
+            continue;
+
+        Context* reader = nullptr;
+
+        d.spawn([&] {
+            Listener listener;
+            ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+            ASSERT_EQ(0, listener.listen(16));
+
+            Connection conn;
+            auto start = Clock::now();
+            ASSERT_FALSE(listener.accept(conn, start + std::chrono::milliseconds(20)));
+            ASSERT_EQ(ETIMEDOUT, errno);
+            ASSERT_GE(Clock::now() - start, std::chrono::milliseconds(20));
+
+            ASSERT_TRUE(listener.accept(conn, Clock::now() + std::chrono::seconds(5)));
+
+            char buf[16];
+            ASSERT_EQ(-1, conn.read(buf, sizeof(buf), Clock::now() + std::chrono::milliseconds(20)));
+            ASSERT_EQ(ETIMEDOUT, errno);
+
+            // no deadline, woken up by interrupt()
+            reader = Context::self();
+            ASSERT_EQ(-1, conn.read(buf, sizeof(buf)));
+            ASSERT_EQ(ECANCELED, errno);
+            reader = nullptr;
+
+            // pending interrupt fails the next wait right away
+            Context::self()->interrupt();
+            ASSERT_EQ(-1, conn.read(buf, sizeof(buf)));
+            ASSERT_EQ(ECANCELED, errno);
+
+            // connection is still usable
+            ASSERT_EQ(5, conn.read(buf, sizeof(buf)));
+            ASSERT_EQ("hello", std::string(buf, 5));
+        });
+
+        d.spawn([&] {
+            Context::sleep_for(std::chrono::milliseconds(40));
+            Connection c;
+            ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+
+            while (reader == nullptr) {
+                Context::sleep_for(std::chrono::milliseconds(5));
+            }
+            Context::sleep_for(std::chrono::milliseconds(5));
+            reader->interrupt();
+
+            Context::sleep_for(std::chrono::milliseconds(20));
+            ASSERT_EQ(5, c.writeAll("hello", 5));
+        });
+
+        d.dispatch();
+    }
+}
+
+TEST(Socket, lazyRegistration)
+{
+    const uint16_t port = 8078;
+
+    // with io_uring waits do not go through the poller
+    if (getenv("IOCORO_IO_URING") != nullptr)
+        return;
+
+    Dispatcher d;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        d.spawn([&] {
+            Connection c;
+            ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+            // waiting for connect registers the socket once, moving
+            // it into the connection retargets it once
+            EXPECT_LE(c.pollStats().pollerCalls, 2u);
+            ASSERT_EQ(5, c.writeAll("hello", 5));
+
+            Context::sleep_for(std::chrono::milliseconds(20));
+            ASSERT_EQ(5, c.writeAll("world", 5));
+        });
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+        Context::sleep_for(std::chrono::milliseconds(10));
+
+        // data is already there, no need to poll
+        char buf[16];
+        ASSERT_EQ(5, conn.read(buf, sizeof(buf)));
+        EXPECT_EQ(0u, conn.pollStats().pollerCalls);
+        EXPECT_EQ(0u, conn.pollStats().waits);
+
+        ASSERT_EQ(5, conn.read(buf, sizeof(buf)));
+        ASSERT_EQ("world", std::string(buf, 5));
+        EXPECT_EQ(1u, conn.pollStats().pollerCalls);
+        EXPECT_EQ(1u, conn.pollStats().waits);
+    });
+
+    d.dispatch();
+}
+
+TEST(Socket, sharedConnection)
+{
+    const uint16_t port = 8077;
+    const std::size_t writers = 4;
+    const std::size_t blockSize = 4 * 1024 * 1024;
+
+    for (bool ring : {false, true}) {
+        Dispatcher d;
+        if (ring && !d.useIoUring())
+            continue;
+
+        d.spawn([&] {
+            Listener listener;
+            ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+            ASSERT_EQ(0, listener.listen(16));
+
+            Connection conn;
+            ASSERT_TRUE(listener.accept(conn));
+
+            // blocks larger than the socket buffers,
+            // so writers have to wait in the middle
+            std::size_t done = 0;
+            for (std::size_t i = 0; i < writers; ++i) {
+                d.spawn([&, i] {
+                    std::vector<char> block(blockSize, 'a' + i);
+                    ASSERT_EQ((int)blockSize, conn.writeAll(block.data(), block.size()));
+                    ++done;
+                });
+            }
+
+            while (done != writers) {
+                Context::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            // two readers wait at once, served in FIFO order
+            char buf[16];
+            std::vector<std::string> replies;
+            for (int i = 0; i < 2; ++i) {
+                d.spawn([&] {
+                    int r = conn.read(buf, sizeof(buf));
+                    ASSERT_GT(r, 0);
+                    replies.emplace_back(buf, r);
+                });
+            }
+
+            while (replies.size() != 2) {
+                Context::sleep_for(std::chrono::milliseconds(1));
+            }
+            EXPECT_EQ("first", replies[0]);
+            EXPECT_EQ("second", replies[1]);
+        });
+
+        d.spawn([&] {
+            Connection c;
+            ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+
+            std::vector<char> data(writers * blockSize);
+            IoVec iov{data.data(), data.size()};
+            ASSERT_EQ((int)data.size(), c.readAll(&iov, 1));
+            for (std::size_t i = 0; i < writers; ++i) {
+                auto block = data.begin() + i * blockSize;
+                EXPECT_EQ(blockSize, (std::size_t)std::count(block, block + blockSize, *block));
+            }
+
+            Context::sleep_for(std::chrono::milliseconds(10));
+            ASSERT_EQ(5, c.writeAll("first", 5));
+            Context::sleep_for(std::chrono::milliseconds(10));
+            ASSERT_EQ(6, c.writeAll("second", 6));
+        });
+
+        d.dispatch();
+    }
 }
 
+TEST(Socket, sharedZeroCopy)
+{
+    const uint16_t port = 8075;
+    const std::size_t blockSize = 4 * 1024 * 1024;
+    Dispatcher d;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+        // without SO_ZEROCOPY the plain path is checked
+        conn.setZeroCopy(true, 64 * 1024);
+
+        std::size_t done = 0;
+        d.spawn([&] {
+            std::vector<char> block(blockSize, 'z');
+            ASSERT_EQ((int)blockSize, conn.writeAll(block.data(), block.size()));
+            ++done;
+        });
+        d.spawn([&] {
+            ASSERT_EQ(5, conn.writeAll("small", 5));
+            ++done;
+        });
+
+        while (done != 2) {
+            Context::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+
+        std::vector<char> data(blockSize + 5);
+        IoVec iov{data.data(), data.size()};
+        ASSERT_EQ((int)data.size(), c.readAll(&iov, 1));
+        EXPECT_EQ(blockSize, (std::size_t)std::count(data.begin(), data.begin() + blockSize, 'z'));
+        EXPECT_EQ("small", std::string(data.data() + blockSize, 5));
+    });
+
+    d.dispatch();
+}
+
+TEST(Socket, callerOwnedSocket)
+{
+    // with io_uring waits do not go through the poller
+    if (getenv("IOCORO_IO_URING") != nullptr)
+        return;
+
+    Dispatcher d;
+
+    d.spawn([&] {
+        int sv[2];
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv));
+        FileHandle peer(sv[1]);
+        // the caller may keep other descriptors of the socket, closing
+        // the connection's one does not drop it from the poller then
+        FileHandle other(::dup(sv[0]));
+
+        Connection c(sv[0]);
+        char buf[16];
+        ASSERT_EQ(-1, c.read(buf, sizeof(buf), Clock::now() + std::chrono::milliseconds(5)));
+        ASSERT_EQ(ETIMEDOUT, errno);
+        EXPECT_EQ(1u, c.pollStats().pollerCalls);
+
+        c.attach(-1);
+        EXPECT_EQ(2u, c.pollStats().pollerCalls);
+        ASSERT_EQ(5, ::write(peer, "hello", 5));
+    });
+
+    d.dispatch();
+}
+
+TEST(Socket, corkedError)
+{
+    const uint16_t port = 8074;
+    Dispatcher d;
+
+    // write to the closed peer raises EPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+        conn.setCorked(true);
+
+        char c;
+        ASSERT_EQ(0, conn.read(&c, 1));
+
+        // the error of a dispatcher flush fails the next corked write
+        int r = 0;
+        for (int i = 0; i < 100 && r >= 0; ++i) {
+            r = conn.writeAll("hello", 5);
+            Context::sleep_for(std::chrono::milliseconds(1));
+        }
+        ASSERT_EQ(-1, r);
+        EXPECT_TRUE(errno == EPIPE || errno == ECONNRESET);
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+    });
+
+    d.dispatch();
+}
+
+TEST(Socket, interruptQueuedWriter)
+{
+    const uint16_t port = 8073;
+    const std::size_t blockSize = 4 * 1024 * 1024;
+    Dispatcher d;
+
+    d.spawn([&] {
+        Listener listener;
+        ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+        ASSERT_EQ(0, listener.listen(16));
+
+        Connection conn;
+        ASSERT_TRUE(listener.accept(conn));
+
+        bool done = false;
+        d.spawn([&] {
+            std::vector<char> block(blockSize, 'a');
+            ASSERT_EQ((int)blockSize, conn.writeAll(block.data(), block.size()));
+            done = true;
+        });
+
+        // waits for the writer above, not for the socket
+        Context* queued = nullptr;
+        d.spawn([&] {
+            queued = Context::self();
+            ASSERT_EQ(-1, conn.writeAll("b", 1));
+            EXPECT_EQ(ECANCELED, errno);
+            queued = nullptr;
+        });
+
+        Context::sleep_for(std::chrono::milliseconds(5));
+        ASSERT_NE(nullptr, queued);
+        queued->interrupt();
+
+        while (!done) {
+            Context::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_EQ(nullptr, queued);
+        conn.shutdown();
+    });
+
+    d.spawn([&] {
+        Connection c;
+        ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+        Context::sleep_for(std::chrono::milliseconds(10));
+
+        // nothing of the cancelled write follows the block
+        std::vector<char> data(64 * 1024);
+        std::size_t total = 0;
+        int r;
+        while ((r = c.read(data.data(), data.size())) > 0) {
+            EXPECT_EQ(std::size_t(r), (std::size_t)std::count(data.begin(), data.begin() + r, 'a'));
+            total += r;
+        }
+        EXPECT_EQ(blockSize, total);
+    });
+
+    d.dispatch();
+}
+
+TEST(Socket, corkedBacklog)
+{
+    // with io_uring waits do not go through the poller
+    if (getenv("IOCORO_IO_URING") != nullptr)
+        return;
+
+    const std::size_t size = Connection::CORK_LIMIT - 1;
+    Dispatcher d;
+
+    int sv[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv));
+    FileHandle peer(sv[1]);
+    int small = 4096;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+
+    // outlives the context that corked the data
+    std::unique_ptr<Connection> conn(new Connection(sv[0]));
+
+    std::size_t received = 0;
+    std::thread reader([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        char buf[4096];
+        while (received < size) {
+            pollfd pfd{peer, POLLIN, 0};
+            if (poll(&pfd, 1, 1000) != 1)
+                break;
+            ssize_t r = ::read(peer, buf, sizeof(buf));
+            if (r <= 0)
+                break;
+            received += r;
+        }
+    });
+
+    d.spawn([&] {
+        conn->setCorked(true);
+        std::vector<char> data(size, 'c');
+        ASSERT_EQ((int)size, conn->writeAll(data.data(), data.size()));
+    });
+
+    // returns once all corked data is sent
+    d.dispatch();
+    reader.join();
+    EXPECT_EQ(size, received);
+
+    // anything left fails with EPIPE instead of blocking the close
+    signal(SIGPIPE, SIG_IGN);
+    peer.close();
+    d.spawn([&] { conn.reset(); });
+    d.dispatch();
+}
+
+TEST(Socket, corkedFlushDeadline)
+{
+    Dispatcher d;
+
+    int sv[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv));
+    FileHandle peer(sv[1]);
+    int small = 4096;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+
+    d.spawn([&] {
+        Connection conn(sv[0]);
+        conn.setCorked(true);
+        std::vector<char> data(Connection::CORK_LIMIT, 'c');
+        ASSERT_EQ((int)data.size(), conn.writeAll(data.data(), data.size()));
+
+        // the peer never reads, so flushing the corked data times out
+        auto deadline = Clock::now() + std::chrono::milliseconds(50);
+        ASSERT_EQ(-1, conn.writeAll("x", 1, deadline));
+        EXPECT_EQ(ETIMEDOUT, errno);
+        EXPECT_GE(Clock::now(), deadline);
+    });
+
+    d.dispatch();
+}
+
+}
@@ -0,0 +1,276 @@
+#include <gtest/gtest.h>
+#include <iosync.h>
+
+#include <vector>
+
+#include <errno.h>
+
+using namespace iocoro;
+
+TEST(Mutex, fifoHandover)
+{
+    Dispatcher d;
+    Mutex m;
+    std::vector<int> order;
+
+    d.spawn([&] {
+        m.lock();
+        // let the others queue up
+        Context::sleep_for(std::chrono::milliseconds(5));
+        order.push_back(0);
+        m.unlock();
+
+        // the mutex went to the first waiter, not to us
+        EXPECT_FALSE(m.try_lock());
+    });
+
+    for (int i = 1; i <= 3; ++i) {
+        d.spawn([&, i] {
+            std::lock_guard<Mutex> lock(m);
+            order.push_back(i);
+            Context::yield();
+        });
+    }
+
+    d.dispatch();
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3}), order);
+}
+
+TEST(Mutex, timeout)
+{
+    Dispatcher d;
+    Mutex m;
+
+    d.spawn([&] {
+        m.lock();
+        Context::sleep_for(std::chrono::milliseconds(30));
+        m.unlock();
+    });
+
+    d.spawn([&] {
+        EXPECT_FALSE(m.try_lock_for(std::chrono::milliseconds(5)));
+        // timed out waiter is gone, this one gets the mutex
+        EXPECT_TRUE(m.try_lock_for(std::chrono::milliseconds(100)));
+        m.unlock();
+    });
+
+    d.dispatch();
+}
+
+TEST(Mutex, interrupt)
+{
+    Dispatcher d;
+    Mutex m;
+    Context* waiter = nullptr;
+
+    d.spawn([&] {
+        m.lock();
+        Context::sleep_for(std::chrono::milliseconds(20));
+        m.unlock();
+
+        // interrupted waiter left the queue, the mutex is free
+        EXPECT_TRUE(m.try_lock());
+        m.unlock();
+    });
+
+    d.spawn([&] {
+        waiter = Context::self();
+        EXPECT_FALSE(m.lock());
+        EXPECT_EQ(ECANCELED, errno);
+    });
+
+    d.spawn([&] {
+        Context::sleep_for(std::chrono::milliseconds(5));
+        waiter->interrupt();
+    });
+
+    d.dispatch();
+}
+
+TEST(SharedMutex, readersAndWriters)
+{
+    Dispatcher d;
+    SharedMutex m;
+    int readers = 0;
+    int maxReaders = 0;
+    bool writing = false;
+
+    auto reader = [&] {
+        m.lock_shared();
+        EXPECT_FALSE(writing);
+        maxReaders = std::max(maxReaders, ++readers);
+        Context::sleep_for(std::chrono::milliseconds(2));
+        --readers;
+        m.unlock_shared();
+    };
+
+    auto writer = [&] {
+        m.lock();
+        EXPECT_EQ(0, readers);
+        writing = true;
+        Context::sleep_for(std::chrono::milliseconds(2));
+        writing = false;
+        m.unlock();
+    };
+
+    for (int i = 0; i < 3; ++i) {
+        d.spawn(reader);
+    }
+    d.spawn(writer);
+    for (int i = 0; i < 3; ++i) {
+        d.spawn(reader);
+    }
+
+    d.dispatch();
+    EXPECT_EQ(3, maxReaders);
+}
+
+TEST(SharedMutex, writerTimeout)
+{
+    Dispatcher d;
+    SharedMutex m;
+    bool read = false;
+
+    d.spawn([&] {
+        m.lock_shared();
+        Context::sleep_for(std::chrono::milliseconds(20));
+        m.unlock_shared();
+    });
+
+    d.spawn([&] {
+        EXPECT_FALSE(m.try_lock_for(std::chrono::milliseconds(5)));
+    });
+
+    d.spawn([&] {
+        // blocked by the waiting writer, released when it gives up
+        auto start = Clock::now();
+        m.lock_shared();
+        EXPECT_LT(Clock::now() - start, std::chrono::milliseconds(15));
+        read = true;
+        m.unlock_shared();
+    });
+
+    d.dispatch();
+    EXPECT_TRUE(read);
+}
+
+TEST(Semaphore, limitsConcurrency)
+{
+    Dispatcher d;
+    Semaphore sem(2);
+    int running = 0;
+    int maxRunning = 0;
+
+    for (int i = 0; i < 6; ++i) {
+        d.spawn([&] {
+            sem.acquire();
+            maxRunning = std::max(maxRunning, ++running);
+            Context::sleep_for(std::chrono::milliseconds(1));
+            --running;
+            sem.release();
+        });
+    }
+
+    d.dispatch();
+    EXPECT_EQ(2, maxRunning);
+    EXPECT_EQ(2u, sem.count());
+}
+
+TEST(Semaphore, timeout)
+{
+    Dispatcher d;
+    Semaphore sem;
+
+    d.spawn([&] {
+        EXPECT_FALSE(sem.try_acquire_for(std::chrono::milliseconds(5)));
+        EXPECT_TRUE(sem.try_acquire_for(std::chrono::milliseconds(100)));
+    });
+
+    d.spawn([&] {
+        Context::sleep_for(std::chrono::milliseconds(20));
+        sem.release();
+    });
+
+    d.dispatch();
+    EXPECT_EQ(0u, sem.count());
+}
+
+TEST(Semaphore, interrupt)
+{
+    Dispatcher d;
+    Semaphore s;
+    Context* waiter = nullptr;
+
+    d.spawn([&] {
+        waiter = Context::self();
+        EXPECT_FALSE(s.acquire());
+        EXPECT_EQ(ECANCELED, errno);
+
+        // pending interrupt fails the next wait right away
+        Context::self()->interrupt();
+        EXPECT_FALSE(s.try_acquire_for(std::chrono::seconds(1)));
+        EXPECT_EQ(ECANCELED, errno);
+    });
+
+    d.spawn([&] {
+        Context::sleep_for(std::chrono::milliseconds(5));
+        waiter->interrupt();
+        Context::sleep_for(std::chrono::milliseconds(5));
+
+        // the unit is not lost to the interrupted waiter
+        s.release();
+        EXPECT_EQ(1u, s.count());
+    });
+
+    d.dispatch();
+}
+
+TEST(ConditionVariable, producerConsumer)
+{
+    Dispatcher d;
+    Mutex m;
+    ConditionVariable cv;
+    std::vector<int> queue;
+    std::vector<int> consumed;
+    const int items = 10;
+
+    d.spawn([&] {
+        std::unique_lock<Mutex> lock(m);
+        while (consumed.size() < items) {
+            cv.wait(lock, [&] { return !queue.empty(); });
+            consumed.insert(consumed.end(), queue.begin(), queue.end());
+            queue.clear();
+        }
+    });
+
+    d.spawn([&] {
+        for (int i = 0; i < items; ++i) {
+            {
+                std::lock_guard<Mutex> lock(m);
+                queue.push_back(i);
+            }
+            cv.notify_one();
+            Context::yield();
+        }
+    });
+
+    d.dispatch();
+    ASSERT_EQ(std::size_t(items), consumed.size());
+    EXPECT_EQ(9, consumed.back());
+}
+
+TEST(ConditionVariable, waitForTimeout)
+{
+    Dispatcher d;
+    Mutex m;
+    ConditionVariable cv;
+
+    d.spawn([&] {
+        std::unique_lock<Mutex> lock(m);
+        EXPECT_FALSE(cv.wait_for(lock, std::chrono::milliseconds(5)));
+        EXPECT_TRUE(lock.owns_lock());
+        EXPECT_FALSE(cv.wait_for(lock, std::chrono::milliseconds(5), [] { return false; }));
+    });
+
+    d.dispatch();
+}
@@ -1,6 +1,15 @@
 #include <iocoro.h>
+#include <ioruntime.h>
+#include <iosocket.h>
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
 
 using namespace iocoro;
 
@@ -28,15 +37,14 @@ public:
 
 TEST_F(Perf, Callcc)
 {
-    auto start = Clock::now();
     auto c = boost::context::callcc([&](boost::context::continuation&& c) {
-        for (int i = 0; i < ITER; ++i) {
+        for (std::size_t i = 0; i < ITER; ++i) {
             c = c.resume();
         } 
         return c.resume();
     });
 
-    for (int i = 0; i < ITER; ++i) {
+    for (std::size_t i = 0; i < ITER; ++i) {
         c = c.resume();
     }
     
@@ -48,7 +56,7 @@ TEST_F(Perf, Switch)
     Dispatcher d;
 
     auto f = [&, this]() {
-        for (int i = 0; i < ITER; ++i) {
+        for (std::size_t i = 0; i < ITER; ++i) {
             ++total;
             Context::yield();
         }
@@ -73,7 +81,7 @@ TEST_F(Perf, SwitchWithSleepers)
             d.spawn(sleeper);
         }
 
-        for (int i = 0; i < ITER; ++i) {
+        for (std::size_t i = 0; i < ITER; ++i) {
             ++total;
             Context::yield();
         }
@@ -94,7 +102,7 @@ TEST_F(Perf, Spawn)
     };
 
     auto f = [&, this]() {
-        for (int i = 0; i < ITER; ++i) {
+        for (std::size_t i = 0; i < ITER; ++i) {
             d.spawn(inner);
         }
     };
@@ -106,3 +114,785 @@ TEST_F(Perf, Spawn)
     d.dispatch();
 }
 
+
+TEST_F(Perf, EventPingPong)
+{
+    Dispatcher d;
+    Event ping;
+    Event pong;
+    bool done = false;
+
+    d.spawn([&, this] {
+        while (!done) {
+            ping.wait();
+            ++total;
+            pong.notify_one();
+        }
+    });
+
+    d.spawn([&, this] {
+        for (std::size_t i = 0; i < ITER; ++i) {
+            ping.notify_one();
+            ++total;
+            pong.wait();
+        }
+        done = true;
+        ping.notify_one();
+    });
+
+    d.dispatch();
+}
+
+TEST_F(Perf, ChannelPingPong)
+{
+    Dispatcher d;
+    Channel<int> ping;
+    Channel<int> pong;
+
+    d.spawn([&, this] {
+        for (std::size_t i = 0; i < ITER; ++i) {
+            ping.send(i);
+            int v;
+            pong.recv(v);
+            total += 2;
+        }
+        ping.close();
+    });
+
+    d.spawn([&] {
+        int v;
+        while (ping.recv(v)) {
+            pong.send(v);
+        }
+    });
+
+    d.dispatch();
+}
+
+TEST_F(Perf, ChannelFanIn)
+{
+    const int PRODUCERS = 16;
+    Dispatcher d;
+    Channel<int> ch(64);
+    int running = PRODUCERS;
+
+    for (int p = 0; p < PRODUCERS; ++p) {
+        d.spawn([&] {
+            for (std::size_t i = 0; i < ITER / PRODUCERS; ++i) {
+                ch.send(i);
+            }
+            if (--running == 0) {
+                ch.close();
+            }
+        });
+    }
+
+    d.spawn([&, this] {
+        int v;
+        while (ch.recv(v)) {
+            ++total;
+        }
+    });
+
+    d.dispatch();
+}
+
+TEST_F(Perf, ManySleepers)
+{
+    const std::size_t SLEEPERS = 1000000;
+    const int SLEEPS = 3;
+
+    // small pooled stacks keep a million contexts within a few GB
+    StackPolicy stacks;
+    stacks.size = 16 * 1024;
+    stacks.pooled = true;
+    Dispatcher d(stacks);
+
+    // every context sleeps several times with different timeouts,
+    // so timers are constantly expiring while the rest keep sleeping
+    for (std::size_t i = 0; i < SLEEPERS; ++i) {
+        d.spawn([&, i] {
+            for (int j = 0; j < SLEEPS; ++j) {
+                auto us = (i * 7919 + j * 104729) % 100000;
+                Context::sleep_for(std::chrono::microseconds(us));
+                ++total;
+            }
+        });
+    }
+
+    d.dispatch();
+
+    auto st = d.stackStats();
+    std::cout << "Stacks reserved: " << st.reserved / 1024 << "KB"
+        << ", committed: " << st.committed / 1024 << "KB" << std::endl;
+}
+
+// Runtime tests repeat the same workload with growing number of
+// worker threads to show how it scales
+class RuntimePerf: public testing::Test
+{
+protected:
+    template <class F>
+    void scale(F&& workload)
+    {
+        std::size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+        for (std::size_t threads = 1; threads <= maxThreads; threads *= 2) {
+            std::atomic<std::size_t> ops{0};
+            auto start = Clock::now();
+            {
+                Runtime rt(threads);
+                workload(rt, ops);
+                rt.join();
+            }
+            auto dur = std::chrono::nanoseconds(Clock::now() - start).count();
+            std::cout << "Threads: " << threads 
+                << ", total time: " << dur << "ns"
+                << ", per op: " << dur / std::max<std::size_t>(1, ops.load()) << "ns" 
+                << std::endl;
+        }
+    }
+};
+
+TEST_F(RuntimePerf, Switch)
+{
+    const std::size_t TASKS = 64;
+
+    scale([&](Runtime& rt, std::atomic<std::size_t>& ops) {
+        for (std::size_t t = 0; t < TASKS; ++t) {
+            rt.spawn([&] {
+                for (std::size_t i = 0; i < ITER / 10; ++i) {
+                    Context::yield();
+                }
+                ops += ITER / 10;
+            });
+        }
+    });
+}
+
+TEST_F(RuntimePerf, Spawn)
+{
+    const std::size_t SPAWNERS = 16;
+
+    scale([&](Runtime& rt, std::atomic<std::size_t>& ops) {
+        for (std::size_t t = 0; t < SPAWNERS; ++t) {
+            rt.spawn([&] {
+                for (std::size_t i = 0; i < ITER / 4; ++i) {
+                    rt.spawn([&] { ops.fetch_add(1, std::memory_order_relaxed); });
+                }
+            });
+        }
+    });
+}
+
+TEST_F(Perf, TimerOvershoot)
+{
+    const int SLEEPS = 200;
+    const std::chrono::microseconds durations[] = {
+        std::chrono::microseconds(10),
+        std::chrono::microseconds(50),
+        std::chrono::microseconds(100),
+        std::chrono::microseconds(500),
+        std::chrono::microseconds(1000),
+        std::chrono::microseconds(2500),
+    };
+
+    Dispatcher d;
+
+    d.spawn([&, this] {
+        for (auto dur : durations) {
+            int64_t sum = 0;
+            int64_t worst = 0;
+
+            for (int i = 0; i < SLEEPS; ++i) {
+                auto deadline = Clock::now() + dur;
+                Context::sleep_until(deadline);
+                int64_t over = DurationNano(Clock::now() - deadline).count();
+                sum += over;
+                worst = std::max(worst, over);
+                ++total;
+            }
+
+            std::cout << "Sleep " << dur.count() << "us"
+                << ", avg overshoot: " << sum / SLEEPS << "ns"
+                << ", max overshoot: " << worst << "ns" << std::endl;
+        }
+    });
+
+    d.dispatch();
+}
+
+// token passed around a ring of contexts, every wakeup goes through
+// the ready list; once without and once with latency tracking
+TEST_F(Perf, WakeLatency)
+{
+    const std::size_t RING = 64;
+
+    for (bool track : {false, true}) {
+        Dispatcher d;
+        d.trackLatency(track);
+
+        std::vector<Context*> ring(RING);
+        std::size_t wakes = 0;
+        bool stop = false;
+        auto begin = Clock::now();
+
+        for (std::size_t i = 0; i < RING; ++i) {
+            d.spawnDeferred([&, i, this] {
+                ring[i] = Context::self();
+                Context::self()->setLatencyTag(i % 2 ? "odd" : "even");
+
+                for (;;) {
+                    Context::self()->disable();
+                    Context::yield();
+                    if (stop)
+                        break;
+
+                    ++total;
+                    if (++wakes == ITER) {
+                        stop = true;
+                        for (Context* c : ring) {
+                            c->enable();
+                        }
+                        break;
+                    }
+                    ring[(i + 1) % RING]->enable();
+                }
+            });
+        }
+
+        d.spawnDeferred([&] { ring[0]->enable(); });
+        d.dispatch();
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+        std::cout << (track ? "tracked" : "untracked") << ": " << ns / ITER << " ns per wakeup";
+        if (track) {
+            const LatencyHistogram& h = d.latency();
+            std::cout << ", p50: " << h.percentile(0.5) << "ns"
+                << ", p99: " << h.percentile(0.99) << "ns"
+                << ", p999: " << h.percentile(0.999) << "ns"
+                << ", odd p99: " << d.latency("odd")->percentile(0.99) << "ns";
+        }
+        std::cout << std::endl;
+    }
+}
+
+const std::size_t TRANSFER_SIZE = 64 * 1024 * 1024;
+const std::size_t CHUNK = 64 * 1024;
+
+// Compares zero-copy transfers with read/write loops on loopback
+class TransferPerf: public testing::Test
+{
+protected:
+    void report(const char* name, std::size_t bytes, Clock::duration dur)
+    {
+        double sec = std::chrono::duration<double>(dur).count();
+        std::cout << name << ": " << int64_t(bytes / sec / (1024 * 1024)) << " MB/s" << std::endl;
+    }
+
+    // reads everything from conn until eof
+    static std::size_t drain(Connection& conn)
+    {
+        std::vector<char> buf(CHUNK);
+        std::size_t total = 0;
+        for (;;) {
+            int r = conn.read(buf.data(), buf.size());
+            if (r <= 0)
+                return total;
+            total += r;
+        }
+    }
+};
+
+TEST_F(TransferPerf, FileToSocket)
+{
+    const uint16_t port = 8091;
+
+    char name[] = "/tmp/iocoro_perfXXXXXX";
+    FileHandle file(mkstemp(name));
+    ASSERT_NE(-1, file.handle());
+    unlink(name);
+    std::vector<char> chunk(CHUNK, 'x');
+    for (std::size_t i = 0; i < TRANSFER_SIZE; i += CHUNK) {
+        ASSERT_EQ(ssize_t(CHUNK), ::write(file, chunk.data(), CHUNK));
+    }
+
+    for (bool zeroCopy : {false, true}) {
+        Dispatcher d;
+        auto start = Clock::now();
+        std::size_t received = 0;
+
+        d.spawn([&] {
+            Listener listener;
+            ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+            ASSERT_EQ(0, listener.listen(16));
+
+            Connection conn;
+            ASSERT_TRUE(listener.accept(conn));
+            if (zeroCopy) {
+                conn.sendFile(file, 0, TRANSFER_SIZE);
+            } else {
+                std::vector<char> buf(CHUNK);
+                for (std::size_t off = 0; off < TRANSFER_SIZE; off += CHUNK) {
+                    ssize_t r = ::pread(file, buf.data(), CHUNK, off);
+                    conn.writeAll(buf.data(), r);
+                }
+            }
+            conn.shutdown();
+        });
+
+        d.spawn([&] {
+            Connection c;
+            ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+            received = drain(c);
+        });
+
+        d.dispatch();
+        EXPECT_EQ(TRANSFER_SIZE, received);
+        report(zeroCopy ? "sendFile" : "pread/writeAll", TRANSFER_SIZE, Clock::now() - start);
+    }
+}
+
+TEST_F(TransferPerf, Proxy)
+{
+    const uint16_t port = 8090;
+
+    for (bool zeroCopy : {false, true}) {
+        Dispatcher d;
+        auto start = Clock::now();
+        std::size_t received = 0;
+
+        d.spawn([&] {
+            Listener listener;
+            ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+            ASSERT_EQ(0, listener.listen(16));
+
+            Connection src;
+            Connection dst;
+            ASSERT_TRUE(listener.accept(src));
+            ASSERT_TRUE(listener.accept(dst));
+
+            if (zeroCopy) {
+                src.spliceTo(dst, TRANSFER_SIZE);
+            } else {
+                std::vector<char> buf(CHUNK);
+                for (;;) {
+                    int r = src.read(buf.data(), buf.size());
+                    if (r <= 0)
+                        break;
+                    dst.writeAll(buf.data(), r);
+                }
+            }
+            dst.shutdown();
+        });
+
+        d.spawn([&] {
+            Connection c;
+            ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+            std::vector<char> chunk(CHUNK, 'x');
+            for (std::size_t i = 0; i < TRANSFER_SIZE; i += CHUNK) {
+                c.writeAll(chunk.data(), CHUNK);
+            }
+            c.shutdown();
+        });
+
+        d.spawn([&] {
+            Context::sleep_for(std::chrono::milliseconds(5));
+            Connection c;
+            ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+            received = drain(c);
+        });
+
+        d.dispatch();
+        EXPECT_EQ(TRANSFER_SIZE, received);
+        report(zeroCopy ? "spliceTo" : "read/writeAll", TRANSFER_SIZE, Clock::now() - start);
+    }
+}
+
+// finds the write size above which MSG_ZEROCOPY pays off
+TEST_F(TransferPerf, ZeroCopyCrossover)
+{
+    const uint16_t port = 8088;
+    const std::size_t sizes[] = {
+        4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024
+    };
+
+    for (std::size_t size : sizes) {
+        for (bool zeroCopy : {false, true}) {
+            Dispatcher d;
+            auto start = Clock::now();
+            std::size_t received = 0;
+
+            d.spawn([&] {
+                Listener listener;
+                ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+                ASSERT_EQ(0, listener.listen(16));
+
+                Connection conn;
+                ASSERT_TRUE(listener.accept(conn));
+                received = drain(conn);
+            });
+
+            d.spawn([&] {
+                Connection c;
+                ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+                if (zeroCopy && c.setZeroCopy(true, 1) != 0) {
+                    std::cout << "MSG_ZEROCOPY not supported" << std::endl;
+                }
+
+                std::vector<char> buf(size, 'x');
+                for (std::size_t sent = 0; sent < TRANSFER_SIZE; sent += size) {
+                    c.writeAll(buf.data(), size);
+                }
+                c.shutdown();
+            });
+
+            d.dispatch();
+            EXPECT_EQ(TRANSFER_SIZE, received);
+
+            std::string name = std::to_string(size / 1024) + "KB " 
+                + (zeroCopy ? "zero-copy" : "copy");
+            report(name.c_str(), TRANSFER_SIZE, Clock::now() - start);
+        }
+    }
+}
+
+// parses newline-terminated lines, one read per byte vs BufferedConnection
+TEST_F(TransferPerf, LineParsing)
+{
+    const uint16_t port = 8086;
+    const std::size_t LINE_SIZE = 64;
+    const std::size_t LINES = 100000;
+
+    for (bool buffered : {false, true}) {
+        Dispatcher d;
+        auto start = Clock::now();
+        std::size_t lines = 0;
+
+        d.spawn([&] {
+            Listener listener;
+            ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+            ASSERT_EQ(0, listener.listen(16));
+
+            Connection conn;
+            ASSERT_TRUE(listener.accept(conn));
+
+            if (buffered) {
+                BufferedConnection in(conn);
+                const char* line = nullptr;
+                while (in.readUntil('\n', line) > 0) {
+                    ++lines;
+                }
+            } else {
+                char c;
+                while (conn.read(&c, 1) == 1) {
+                    if (c == '\n')
+                        ++lines;
+                }
+            }
+        });
+
+        d.spawn([&] {
+            Connection c;
+            ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+            BufferedConnection out(c);
+            std::string line(LINE_SIZE - 1, 'x');
+            line += '\n';
+            for (std::size_t i = 0; i < LINES; ++i) {
+                out.write(line.data(), line.size());
+            }
+            out.flush();
+            c.shutdown();
+        });
+
+        d.dispatch();
+        EXPECT_EQ(LINES, lines);
+        report(buffered ? "readUntil" : "read per byte", LINES * LINE_SIZE, Clock::now() - start);
+    }
+}
+
+// pipelined small requests and replies, one write per reply vs corked
+TEST_F(TransferPerf, Pipelined)
+{
+    const uint16_t port = 8084;
+    const std::size_t MESSAGES = 200000;
+    const std::string request = "GET /key\n";
+    const std::string reply = "VALUE 0123456789\n";
+
+    for (bool corked : {false, true}) {
+        Dispatcher d;
+        auto start = Clock::now();
+        std::size_t replies = 0;
+
+        d.spawn([&] {
+            Listener listener;
+            ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+            ASSERT_EQ(0, listener.listen(16));
+
+            Connection conn;
+            ASSERT_TRUE(listener.accept(conn));
+            conn.setCorked(corked);
+
+            BufferedConnection in(conn);
+            const char* line = nullptr;
+            while (in.readUntil('\n', line) > 0) {
+                conn.writeAll(reply.data(), reply.size());
+            }
+        });
+
+        d.spawn([&] {
+            Connection c;
+            ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+            c.setCorked(corked);
+
+            d.spawn([&] {
+                for (std::size_t i = 0; i < MESSAGES; ++i) {
+                    c.writeAll(request.data(), request.size());
+                    // let replies be read while requests are in flight
+                    if (i % 64 == 63)
+                        Context::yield();
+                }
+                c.flush();
+            });
+
+            BufferedConnection in(c);
+            const char* line = nullptr;
+            while (replies < MESSAGES && in.readUntil('\n', line) > 0) {
+                ++replies;
+            }
+            c.shutdown();
+        });
+
+        d.dispatch();
+        EXPECT_EQ(MESSAGES, replies);
+
+        auto dur = Clock::now() - start;
+        std::cout << (corked ? "corked" : "write per message") << ": " 
+            << int64_t(MESSAGES / std::chrono::duration<double>(dur).count()) 
+            << " msg/s" << std::endl;
+    }
+}
+
+// loopback packet rate: one syscall per datagram, recvmmsg/sendmmsg,
+// and UDP_SEGMENT sends received with UDP_GRO
+TEST_F(TransferPerf, DatagramRate)
+{
+    const uint16_t port = 8082;
+    const std::size_t PACKETS = 200000;
+    // acknowledged windows keep the receive buffer from overflowing
+    const std::size_t WINDOW = 64;
+    const std::size_t PACKET_SIZE = 64;
+
+    enum Mode { Single, Batched, Offload };
+    const char* names[] = {"send/recvFrom", "sendMany/recvMany", "segment/offload"};
+
+    for (Mode mode : {Single, Batched, Offload}) {
+        Dispatcher d;
+        auto start = Clock::now();
+        std::size_t received = 0;
+        bool offload = true;
+
+        d.spawn([&] {
+            DatagramSocket rx;
+            ASSERT_EQ(0, rx.bind(IP4Endpoint(IP4Address::loopback(), port)));
+            if (mode == Offload && rx.setReceiveOffload(true) != 0)
+                offload = false;
+
+            // with offload a buffer may take the whole window
+            std::size_t bufSize = mode == Offload ? WINDOW * PACKET_SIZE : PACKET_SIZE;
+            std::vector<char> storage(WINDOW * bufSize);
+            std::vector<Datagram> msgs(WINDOW);
+            for (std::size_t i = 0; i < WINDOW; ++i) {
+                msgs[i].buf = IoVec{&storage[i * bufSize], bufSize};
+            }
+
+            IP4Endpoint peer;
+            while (received < PACKETS) {
+                for (std::size_t n = 0; n < WINDOW;) {
+                    if (mode == Single) {
+                        ASSERT_GT(rx.recvFrom(storage.data(), PACKET_SIZE, &peer), 0);
+                        ++n;
+                        continue;
+                    }
+
+                    int r = rx.recvMany(msgs.data(), msgs.size());
+                    ASSERT_GT(r, 0);
+                    peer = msgs[0].endpoint;
+                    for (int i = 0; i < r; ++i) {
+                        std::size_t segment = msgs[i].segmentSize;
+                        n += segment ? (msgs[i].size + segment - 1) / segment : 1;
+                    }
+                }
+                received += WINDOW;
+                rx.sendTo("a", 1, peer);
+            }
+        });
+
+        d.spawn([&] {
+            DatagramSocket tx;
+            ASSERT_EQ(0, tx.connect(IP4Endpoint(IP4Address::loopback(), port)));
+
+            std::vector<char> payload(WINDOW * PACKET_SIZE, 'x');
+            std::vector<Datagram> msgs(WINDOW);
+            for (auto& m : msgs) {
+                m.buf = IoVec{payload.data(), PACKET_SIZE};
+            }
+
+            if (mode == Offload && tx.setSegmentSize(PACKET_SIZE) != 0)
+                offload = false;
+
+            char ack;
+            for (std::size_t sent = 0; sent < PACKETS; sent += WINDOW) {
+                if (mode == Single || !offload) {
+                    for (std::size_t i = 0; i < WINDOW; ++i) {
+                        tx.send(payload.data(), PACKET_SIZE);
+                    }
+                } else if (mode == Batched) {
+                    tx.sendMany(msgs.data(), msgs.size());
+                } else {
+                    tx.send(payload.data(), payload.size());
+                }
+                tx.recvFrom(&ack, 1);
+            }
+        });
+
+        d.dispatch();
+        EXPECT_GE(received, PACKETS);
+
+        auto dur = Clock::now() - start;
+        std::cout << names[mode] << (offload ? "" : " (offload not supported)") << ": " 
+            << int64_t(received / std::chrono::duration<double>(dur).count()) 
+            << " packets/s" << std::endl;
+    }
+}
+
+// request/reply round trip over TCP loopback vs a Unix domain socket
+TEST_F(TransferPerf, LocalRoundTrip)
+{
+    const std::size_t ROUND_TRIPS = 50000;
+    const std::string path = "/tmp/iocoro_perf_" + std::to_string(getpid()) + ".sock";
+
+    for (bool local : {false, true}) {
+        Endpoint ep = local ? Endpoint::local(path) 
+            : Endpoint(IP4Endpoint(IP4Address::loopback(), 8079));
+        unlink(path.c_str());
+
+        Dispatcher d;
+        Clock::time_point start;
+
+        d.spawn([&] {
+            Listener listener;
+            ASSERT_EQ(0, listener.bind(ep));
+            ASSERT_EQ(0, listener.listen(16));
+
+            Connection conn;
+            ASSERT_TRUE(listener.accept(conn));
+            char buf[64];
+            int r;
+            while ((r = conn.read(buf, sizeof(buf))) > 0) {
+                conn.writeAll(buf, r);
+            }
+        });
+
+        d.spawn([&] {
+            Connection c;
+            ASSERT_EQ(0, c.connect(ep));
+            char buf[64] = {};
+            start = Clock::now();
+            for (std::size_t i = 0; i < ROUND_TRIPS; ++i) {
+                c.writeAll(buf, sizeof(buf));
+                IoVec v{buf, sizeof(buf)};
+                ASSERT_EQ(int(sizeof(buf)), c.readAll(&v, 1));
+            }
+            c.shutdown();
+        });
+
+        d.dispatch();
+        unlink(path.c_str());
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        std::cout << (local ? "unix socket" : "tcp loopback") << ": " 
+            << ns / ROUND_TRIPS << " ns per round trip" << std::endl;
+    }
+}
+
+// several producers answering on one connection: through a dedicated
+// writer context fed by a channel, or calling writeAll() directly,
+// also with a corked connection
+TEST_F(TransferPerf, SharedWriters)
+{
+    const uint16_t port = 8076;
+    const std::size_t PRODUCERS = 16;
+    const std::size_t MESSAGES = 400000;
+    const std::string reply(64, 'r');
+
+    const char* modes[] = {"writer context", "direct writeAll", "direct corked"};
+
+    for (int mode = 0; mode < 3; ++mode) {
+        const bool direct = mode != 0;
+        Dispatcher d;
+        auto start = Clock::now();
+        std::size_t received = 0;
+
+        d.spawn([&] {
+            Listener listener;
+            ASSERT_EQ(0, listener.bind(IP4Endpoint(IP4Address::any(), port)));
+            ASSERT_EQ(0, listener.listen(16));
+
+            Connection conn;
+            ASSERT_TRUE(listener.accept(conn));
+            conn.setCorked(mode == 2);
+
+            Channel<std::string> queue(64);
+            std::size_t running = PRODUCERS;
+            bool writerDone = direct;
+
+            if (!direct) {
+                d.spawn([&] {
+                    std::string msg;
+                    while (queue.recv(msg)) {
+                        conn.writeAll(msg.data(), msg.size());
+                    }
+                    writerDone = true;
+                });
+            }
+
+            for (std::size_t p = 0; p < PRODUCERS; ++p) {
+                d.spawn([&] {
+                    for (std::size_t i = 0; i < MESSAGES / PRODUCERS; ++i) {
+                        if (direct) {
+                            conn.writeAll(reply.data(), reply.size());
+                        } else {
+                            queue.send(std::string(reply));
+                        }
+                        if (i % 16 == 15)
+                            Context::yield();
+                    }
+
+                    if (--running == 0) {
+                        queue.close();
+                        conn.flush();
+                    }
+                });
+            }
+
+            while (running != 0 || !writerDone) {
+                Context::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+
+        d.spawn([&] {
+            Connection c;
+            ASSERT_EQ(0, c.connect(IP4Endpoint(IP4Address::loopback(), port)));
+            received = drain(c);
+        });
+
+        d.dispatch();
+        EXPECT_EQ(MESSAGES * reply.size(), received);
+
+        auto dur = Clock::now() - start;
+        std::cout << modes[mode] << ": "
+            << int64_t(MESSAGES / std::chrono::duration<double>(dur).count())
+            << " msg/s" << std::endl;
+    }
+}